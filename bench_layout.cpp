@@ -0,0 +1,159 @@
+﻿#include "bench_layout.h"
+#include "grid2d.h"
+#include "inertial.h"
+#include "simulate.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// 傾斜角 [度]（Sobel, 外周は 0）
+template <class L>
+static void slopeKernel(const Grid2D<double, L>& dem, Grid2D<float, L>& out) {
+    const int W = dem.width();
+    const int H = dem.height();
+    const double inv8 = 1.0 / (8.0 * w);
+    forEachTile(dem.tiles(sizeof(double) + sizeof(float)), [&](const Tile& t) {
+        for (int y = max(t.y0, 1); y < min(t.y1, H - 1); ++y) {
+            for (int x = max(t.x0, 1); x < min(t.x1, W - 1); ++x) {
+                double zx = ((dem(x + 1, y - 1) + 2 * dem(x + 1, y) + dem(x + 1, y + 1)) - (dem(x - 1, y - 1) + 2 * dem(x - 1, y) + dem(x - 1, y + 1))) * inv8;
+                double zy = ((dem(x - 1, y - 1) + 2 * dem(x, y - 1) + dem(x + 1, y - 1)) - (dem(x - 1, y + 1) + 2 * dem(x, y + 1) + dem(x + 1, y + 1))) * inv8;
+                out(x, y) = (float)(atan(sqrt(zx * zx + zy * zy)) * 57.29578);
+            }
+        }
+    });
+}
+
+// D8の流向（computeFlowDirection と同じ）
+template <class L>
+static void flowDirKernel(const Grid2D<double, L>& dem, Grid2D<uint8_t, L>& out) {
+    const int W = dem.width();
+    const int H = dem.height();
+    forEachTile(dem.tiles(sizeof(double) + 1), [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                double minElev = dem(x, y);
+                int minDir = 0;
+                for (int d = 0; d < 8; ++d) {
+                    int nx = x + dxc[d];
+                    int ny = y + dyc[d];
+                    if (nx < 0 || nx >= W || ny < 0 || ny >= H) continue;
+                    if (dem(nx, ny) < minElev) {
+                        minElev = dem(nx, ny);
+                        minDir = dirCode[d];
+                    }
+                }
+                out(x, y) = (uint8_t)minDir;
+            }
+        }
+    });
+}
+
+// 局所慣性近似の1ステップ（simulateLocalInertial の面の流量と水深の更新, 外周は閉境界）
+// qx(x, y): セル x-1 と x の間の面, qy(x, y): セル y-1 と y の間の面
+template <class L>
+static void inertialKernel(const Grid2D<double, L>& z, Grid2D<double, L>& h, Grid2D<double, L>& qx, Grid2D<double, L>& qy, double dt) {
+    const int W = z.width();
+    const int H = z.height();
+    const double n2 = 0.03 * 0.03;
+    const double hmin = 1e-6;
+    const TileGrid tiles = z.tiles(4 * sizeof(double));
+
+    forEachTile(tiles, [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                double eta = z(x, y) + h(x, y);
+                if (x > 0) qx(x, y) = inertialFlux(qx(x, y), z(x - 1, y) + h(x - 1, y), eta, z(x - 1, y), z(x, y), n2, dt, hmin);
+                if (y > 0) qy(x, y) = inertialFlux(qy(x, y), z(x, y - 1) + h(x, y - 1), eta, z(x, y - 1), z(x, y), n2, dt, hmin);
+            }
+        }
+    });
+
+    forEachTile(tiles, [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                double east = (x + 1 < W) ? qx(x + 1, y) : 0.0;
+                double south = (y + 1 < H) ? qy(x, y + 1) : 0.0;
+                double hn = h(x, y) + dt / w * (qx(x, y) - east + qy(x, y) - south);
+                h(x, y) = (hn > 0.0) ? hn : 0.0;
+            }
+        }
+    });
+}
+
+// 最も速かった回の時間 [ms]
+template <class F>
+static double bestOf(int repeat, F f) {
+    double best = 1e30;
+    for (int r = 0; r < repeat; ++r) {
+        auto t0 = chrono::high_resolution_clock::now();
+        f();
+        auto t1 = chrono::high_resolution_clock::now();
+        best = min(best, chrono::duration<double, milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+static void printRow(const char* kernel, const char* layout, double ms, size_t cells, double check) {
+    cout << kernel << "（" << layout << "）: " << fixed << setprecision(2) << ms << "ms, "
+        << ms * 1e6 / cells << "ns/セル (check " << setprecision(6) << check << ")\n" << defaultfloat;
+}
+
+// 1つの並べ方で3つのカーネルを測る
+template <class L>
+static void benchOne(const char* name, const vector<vector<double>>& mosaic, int size, int repeat) {
+    const size_t cells = (size_t)size * size;
+    Grid2D<double, L> dem = Grid2D<double, L>::fromRows(mosaic, size, size);
+
+    {
+        Grid2D<float, L> slope(size, size, 0.0f);
+        double ms = bestOf(repeat, [&]() { slopeKernel(dem, slope); });
+        double sum = 0.0;
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) sum += slope(x, y);
+        }
+        printRow("傾斜", name, ms, cells, sum / cells);
+    }
+    {
+        Grid2D<uint8_t, L> dir(size, size, 0);
+        double ms = bestOf(repeat, [&]() { flowDirKernel(dem, dir); });
+        double sum = 0.0;
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) sum += dir(x, y);
+        }
+        printRow("流向", name, ms, cells, sum / cells);
+    }
+    {
+        Grid2D<double, L> h(size, size, 0.05);
+        Grid2D<double, L> qx(size, size, 0.0);
+        Grid2D<double, L> qy(size, size, 0.0);
+        double ms = bestOf(repeat, [&]() { inertialKernel(dem, h, qx, qy, 0.1); });
+        double sum = 0.0;
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) sum += h(x, y);
+        }
+        printRow("局所慣性", name, ms, cells, sum / cells);
+    }
+}
+
+// グリッドの並べ方の比較
+void benchLayouts(const vector<vector<double>>& dem, int width, int height, int size, int repeat) {
+    // DEM を鏡映しに並べたモザイク（継ぎ目で段差ができない）
+    vector<vector<double>> mosaic(size, vector<double>(size));
+    for (int y = 0; y < size; ++y) {
+        int my = y % (2 * height);
+        if (my >= height) my = 2 * height - 1 - my;
+        for (int x = 0; x < size; ++x) {
+            int mx = x % (2 * width);
+            if (mx >= width) mx = 2 * width - 1 - mx;
+            mosaic[y][x] = dem[my][mx];
+        }
+    }
+
+    cout << "並べ方の比較: " << size << "x" << size << "（" << repeat << "回の最速, 局所慣性は1ステップごと）\n";
+    benchOne<RowMajorLayout>("行優先", mosaic, size, repeat);
+    benchOne<BlockedLayout<8>>("ブロック8", mosaic, size, repeat);
+    benchOne<BlockedLayout<32>>("ブロック32", mosaic, size, repeat);
+    benchOne<MortonLayout>("Z順", mosaic, size, repeat);
+}
@@ -0,0 +1,14 @@
+﻿#ifndef BENCH_LAYOUT_H
+#define BENCH_LAYOUT_H
+
+#include <vector>
+
+using namespace std;
+
+// グリッドの並べ方（grid2d.h の行優先・ブロック・Z 順）の比較
+// DEM を鏡映しに並べて size x size のモザイクを作り、傾斜・D8の流向・局所慣性近似の1ステップの時間を並べ方ごとに測る
+// 並べ方が違っても結果は同じなので、チェックサムも表示する
+// （river_sim --bench-layout [size] で実行）
+void benchLayouts(const vector<vector<double>>& dem, int width, int height, int size = 2048, int repeat = 3);
+
+#endif // BENCH_LAYOUT_H
@@ -0,0 +1,92 @@
+﻿#include "boundary.h"
+#include "simulate.h"
+#include "cellflags.h"
+#include <cmath>
+#include <algorithm>
+
+static const double g = 9.81; // 重力加速度 [m/s^2]
+
+
+// 外周セル1つの境界流出（水深の変化 [m]、負なら流入）
+// h: 今の水深, bed: 河床, bedInner: 1つ内側のセルの河床
+static double edgeOutflow(const EdgeBoundary& b, double h, double bed, double bedInner, double n, double DT) {
+    double q = 0.0; // 単位幅流量 [m^2/s]
+
+    switch (b.type) {
+    case BoundaryType::FreeOutflow: {
+        if (h <= 1e-6) return 0.0;
+        double S = (bedInner - bed) / w; // 外向きの地形勾配
+        if (S < b.minSlope) S = b.minSlope;
+        q = (1.0 / n) * pow(h, 5.0 / 3.0) * sqrt(S); // 広幅の等流（径深 ≒ 水深）
+        break;
+    }
+    case BoundaryType::CriticalDepth: {
+        if (h <= 1e-6) return 0.0;
+        double hc = h * 2.0 / 3.0; // 境界面の限界水深
+        q = sqrt(g * hc * hc * hc);
+        break;
+    }
+    case BoundaryType::FixedStage: {
+        double dh = bed + h - b.stage;             // 外側水位との水面差
+        double hf = max(bed + h, b.stage) - bed;   // 境界面の水深
+        if (fabs(dh) < 1e-9 || hf <= 1e-6) return 0.0;
+        q = (1.0 / n) * pow(hf, 5.0 / 3.0) * sqrt(fabs(dh) / w);
+
+        double d = q * DT / w;
+        if (d > fabs(dh) / 2) d = fabs(dh) / 2; // 水面差の半分まで（内部の流れと同じ制限）
+        return (dh > 0.0) ? min(d, h) : -d;
+    }
+    default:
+        return 0.0;
+    }
+
+    double d = q * DT / w; // q * w * DT / (w * w)
+    return min(d, h);
+}
+
+// 外周セルに境界条件を適用する
+double applyBoundaries(const BoundaryConfig& bc, BoundaryFlux* flux, vector<vector<double>>& nextWater, const vector<vector<double>>& water, const vector<vector<double>>& surface, int width, int height, double DT, double n, const CellFlags* channelFlags) {
+    const double cellArea = w * w;
+    double total = 0.0;
+
+    for (int e = 0; e < 4; ++e) {
+        const EdgeBoundary& b = bc.edge[e];
+        double volume = 0.0;
+
+        if (b.type != BoundaryType::Closed) {
+            bool horizontal = (e == EDGE_NORTH || e == EDGE_SOUTH); // 辺に沿って x が動くか
+            int count = horizontal ? width : height;
+
+            for (int i = 0; i < count; ++i) {
+                int y, x, iy, ix; // 外周セルと1つ内側のセル
+                if (horizontal) {
+                    x = ix = i;
+                    y = (e == EDGE_NORTH) ? 0 : height - 1;
+                    iy = (e == EDGE_NORTH) ? 1 : height - 2;
+                }
+                else {
+                    y = iy = i;
+                    x = (e == EDGE_WEST) ? 0 : width - 1;
+                    ix = (e == EDGE_WEST) ? 1 : width - 2;
+                }
+
+                if (channelFlags && channelFlags->has((size_t)y * width + x, CELL_CHANNEL)) continue; // 河道から領域外へは channelStep で流す
+
+                double bed = surface[y][x] - water[y][x];
+                double bedInner = surface[iy][ix] - water[iy][ix];
+                double out = edgeOutflow(b, nextWater[y][x], bed, bedInner, n, DT);
+                if (out == 0.0) continue;
+
+                nextWater[y][x] -= out;
+                volume += out * cellArea;
+            }
+        }
+
+        if (flux) {
+            flux->step[e] = volume;
+            flux->total[e] += volume;
+        }
+        total += volume;
+    }
+    return total;
+}
@@ -0,0 +1,67 @@
+﻿#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+#include <vector>
+
+using namespace std;
+
+struct CellFlags; // cellflags.h
+
+// 境界条件の種類
+enum class BoundaryType {
+    Closed,        // 閉境界（出入りなし）
+    FreeOutflow,   // 自由流出（地形勾配による等流）
+    FixedStage,    // 水位固定（外側の水位 stage と水面差で出入り）
+    CriticalDepth  // 限界水深で流出
+};
+
+// 辺の番号
+enum Edge {
+    EDGE_NORTH = 0, // y = 0
+    EDGE_SOUTH = 1, // y = height - 1
+    EDGE_WEST = 2,  // x = 0
+    EDGE_EAST = 3   // x = width - 1
+};
+
+// 1辺の境界条件
+struct EdgeBoundary {
+    BoundaryType type = BoundaryType::Closed;
+    double stage = 0.0;     // FixedStage の外側水位（標高）[m]
+    double minSlope = 1e-3; // FreeOutflow の最小勾配（平坦な辺でも流すため）
+};
+
+// 4辺の境界条件
+struct BoundaryConfig {
+    EdgeBoundary edge[4];
+
+    // 全ての辺を同じ条件にする
+    void setAll(BoundaryType type) {
+        for (int e = 0; e < 4; ++e) edge[e].type = type;
+    }
+};
+
+// 境界からの流出量の記録 [m^3]（流入は負）
+struct BoundaryFlux {
+    double step[4] = { 0.0, 0.0, 0.0, 0.0 };  // このステップの流出量
+    double total[4] = { 0.0, 0.0, 0.0, 0.0 }; // 累積の流出量
+
+    double stepVolume() const { return step[0] + step[1] + step[2] + step[3]; }
+    double totalVolume() const { return total[0] + total[1] + total[2] + total[3]; }
+};
+
+// 外周セルに境界条件を適用する（戻り値は領域外への流出量 [m^3]）
+// nextWater: 内部の流れを反映した水深（ここから流出させる）
+// water, surface: ステップ開始時の水深と水面（河床 = surface - water）
+// channelFlags: 1次元の河道があればそのフラグ（CELL_CHANNEL のセルは channelStep で流すので境界からは流さない）
+double applyBoundaries(
+    const BoundaryConfig& bc,
+    BoundaryFlux* flux,
+    vector<vector<double>>& nextWater,
+    const vector<vector<double>>& water,
+    const vector<vector<double>>& surface,
+    int width, int height,
+    double DT, double n,
+    const CellFlags* channelFlags = nullptr
+);
+
+#endif // BOUNDARY_H
@@ -0,0 +1,120 @@
+﻿#ifndef CELLFLAGS_H
+#define CELLFLAGS_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+using namespace std;
+
+// セルの種類（1セル1バイトのビットの組み合わせ）
+enum CellFlag : uint8_t {
+    CELL_WATERBODY = 1 << 0, // 水域（DEMの欠損値だったセル）
+    CELL_RIVER     = 1 << 1, // 河道網（streams.h）
+    CELL_CHANNEL   = 1 << 2, // 1次元の河道として流すセル（channel.h）
+    CELL_BOUNDARY  = 1 << 3, // 外周
+    CELL_SINK      = 1 << 4, // 流向のない窪地（外周以外）
+    CELL_DRY       = 1 << 5, // 水がない（計算のたびに更新）
+    CELL_DIRTY     = 1 << 6  // 前のステップで水深が変わった（D8の流向を計算し直す, updateFlowDirection で消す）
+};
+
+// セルの種類と水域の番号（グリッドと一緒に持ち回る）
+struct CellFlags {
+    int width = 0;
+    int height = 0;
+    vector<uint8_t> bits;       // y * width + x
+    vector<uint32_t> waterBody; // 水域の番号（0 = 陸, つながった水域ごとに 1, 2, ...）
+    uint32_t waterBodies = 0;
+
+    bool has(size_t i, uint8_t f) const { return (bits[i] & f) != 0; }
+    void set(size_t i, uint8_t f) { bits[i] |= f; }
+    void clear(size_t i, uint8_t f) { bits[i] &= (uint8_t)~f; }
+};
+
+// 作成（外周のセルに CELL_BOUNDARY を付ける）
+inline CellFlags makeCellFlags(int width, int height) {
+    CellFlags cf;
+    cf.width = width;
+    cf.height = height;
+    cf.bits.assign((size_t)width * height, 0);
+    cf.waterBody.assign((size_t)width * height, 0);
+    for (int x = 0; x < width; ++x) {
+        cf.bits[x] |= CELL_BOUNDARY;
+        cf.bits[(size_t)(height - 1) * width + x] |= CELL_BOUNDARY;
+    }
+    for (int y = 0; y < height; ++y) {
+        cf.bits[(size_t)y * width] |= CELL_BOUNDARY;
+        cf.bits[(size_t)y * width + width - 1] |= CELL_BOUNDARY;
+    }
+    return cf;
+}
+
+// f のどれかのビットが立っているセルの数
+inline size_t countFlags(const CellFlags& cf, uint8_t f) {
+    const uint8_t* b = cf.bits.data();
+    const long long n = (long long)cf.bits.size();
+    long long count = 0;
+#pragma omp simd reduction(+:count)
+    for (long long i = 0; i < n; ++i) {
+        count += (b[i] & f) ? 1 : 0;
+    }
+    return (size_t)count;
+}
+
+// 水深から CELL_DRY を付け直す（1行分, 分岐なし, 戻り値は水のあるセル数）
+inline int updateDryRow(uint8_t* bits, const double* h, int width, double hmin) {
+    int wet = 0;
+#pragma omp simd reduction(+:wet)
+    for (int x = 0; x < width; ++x) {
+        uint8_t dry = (h[x] <= hmin) ? (uint8_t)CELL_DRY : (uint8_t)0;
+        bits[x] = (uint8_t)((bits[x] & (uint8_t)~CELL_DRY) | dry);
+        wet += (h[x] > hmin);
+    }
+    return wet;
+}
+
+// 流向のない内部のセルに CELL_SINK を付ける
+inline void markSinks(CellFlags& cf, const vector<vector<int>>& flowDir) {
+    for (int y = 0; y < cf.height; ++y) {
+        for (int x = 0; x < cf.width; ++x) {
+            size_t i = (size_t)y * cf.width + x;
+            if (flowDir[y][x] == 0 && !cf.has(i, CELL_BOUNDARY)) cf.set(i, CELL_SINK);
+            else cf.clear(i, CELL_SINK);
+        }
+    }
+}
+
+// つながった水域に番号を付ける（8近傍）
+inline void labelWaterBodies(CellFlags& cf) {
+    const int W = cf.width;
+    const int H = cf.height;
+    fill(cf.waterBody.begin(), cf.waterBody.end(), 0u);
+    cf.waterBodies = 0;
+    vector<uint32_t> stack;
+    for (size_t s = 0; s < cf.bits.size(); ++s) {
+        if (!cf.has(s, CELL_WATERBODY) || cf.waterBody[s]) continue;
+        uint32_t id = ++cf.waterBodies;
+        cf.waterBody[s] = id;
+        stack.push_back((uint32_t)s);
+        while (!stack.empty()) {
+            uint32_t i = stack.back();
+            stack.pop_back();
+            int y = (int)(i / W);
+            int x = (int)(i % W);
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int ny = y + dy;
+                    int nx = x + dx;
+                    if (ny < 0 || ny >= H || nx < 0 || nx >= W) continue;
+                    size_t j = (size_t)ny * W + nx;
+                    if (!cf.has(j, CELL_WATERBODY) || cf.waterBody[j]) continue;
+                    cf.waterBody[j] = id;
+                    stack.push_back((uint32_t)j);
+                }
+            }
+        }
+    }
+}
+
+#endif // CELLFLAGS_H
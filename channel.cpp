@@ -0,0 +1,173 @@
+﻿#include "channel.h"
+#include "simulate.h"
+#include <cmath>
+#include <algorithm>
+
+static const double WEIR_C = 1.7; // 越流係数（広頂堰, m^0.5/s）
+
+
+// 河道の作成
+ChannelState makeChannel(const StreamNetwork& net, const FlowAccumulation& acc, const vector<vector<double>>& dem, CellFlags& flags) {
+    ChannelState ch;
+    const int width = acc.width;
+    const int height = acc.height;
+    const size_t cells = (size_t)width * height;
+    ch.width = width;
+    ch.height = height;
+    ch.dem = &dem;
+    ch.channelWidth = w;
+    ch.flags = &flags;
+    ch.bankDepth.assign(cells, 0.0f);
+
+    // 河道網の順（上流の区間から、区間の中は上流から）に並べる
+    vector<uint32_t> index(cells, FLOW_NONE);
+    for (size_t r = 0; r < net.reaches(); ++r) {
+        float s = max(net.slope[r], 1e-4f);
+        for (uint32_t k = net.cellStart[r]; k < net.cellStart[r + 1]; ++k) {
+            uint32_t c = net.cellList[k];
+            if (!flags.has(c, CELL_WATERBODY)) continue;
+            index[c] = (uint32_t)ch.cells.size();
+            ch.cells.push_back(c);
+            ch.slope.push_back(s);
+        }
+    }
+    // 河道網に入らなかった水域のセルは氾濫原として扱う
+    for (size_t i = 0; i < cells; ++i) {
+        if (index[i] != FLOW_NONE) flags.set(i, CELL_CHANNEL);
+        else flags.clear(i, CELL_CHANNEL);
+    }
+
+    const size_t m = ch.cells.size();
+    ch.next.assign(m, FLOW_NONE);
+    ch.outCell.assign(m, FLOW_NONE);
+    ch.qin.assign(m, 0.0);
+    for (size_t k = 0; k < m; ++k) {
+        uint32_t c = ch.cells[k];
+        uint32_t d = acc.down[c];
+        if (d != FLOW_NONE && flags.has(d, CELL_CHANNEL)) ch.next[k] = index[d]; // 下流の河道セルは必ず後ろにある
+        else ch.outCell[k] = d;
+
+        // 岸の深さ：隣の氾濫原のセルのうち一番低い地表まで
+        int y = (int)(c / width);
+        int x = (int)(c % width);
+        double bank = 1e9; // 周りが全部河道ならあふれない
+        for (int dd = 0; dd < 8; ++dd) {
+            int nx = x + dxc[dd];
+            int ny = y + dyc[dd];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+            if (flags.has((size_t)ny * width + nx, CELL_CHANNEL)) continue;
+            bank = min(bank, dem[ny][nx] - dem[y][x]);
+        }
+        ch.bankDepth[c] = (float)max(bank, 0.0);
+    }
+    return ch;
+}
+
+// 陰解法のキネマティックウェーブ（1セル分）
+// h' + dt/Ac * Q(h') = b をニュートン法で解く（Q は単調増加なので解は1つ, 時間刻みによらず安定）
+static double solveKinematic(double b, double h0, double alpha, double B, double dtA) {
+    if (b <= 1e-9) return b;
+    double lo = 0.0, hi = b;
+    double h = min(max(h0, 0.0), b);
+    if (h <= 0.0) h = 0.5 * b;
+
+    for (int it = 0; it < 30; ++it) {
+        double A = B * h;
+        double P = B + 2.0 * h;
+        double Q = alpha * A * pow(A / P, 2.0 / 3.0);
+        double g = h + dtA * Q - b;
+        if (fabs(g) < 1e-10) break;
+        if (g > 0.0) hi = h;
+        else lo = h;
+
+        double dg = 1.0 + dtA * Q * (5.0 / (3.0 * h) - 4.0 / (3.0 * P));
+        double hn = h - g / dg;
+        if (hn <= lo || hn >= hi) hn = 0.5 * (lo + hi); // 囲みの外に出たら二分法
+        h = hn;
+    }
+    return h;
+}
+
+// 河道を dt 秒流す
+static void routeChannels(ChannelState& ch, vector<vector<double>>& water, double dt) {
+    const double Ac = w * w;
+    const double B = ch.channelWidth;
+    const int width = ch.width;
+    fill(ch.qin.begin(), ch.qin.end(), 0.0);
+
+    for (size_t k = 0; k < ch.cells.size(); ++k) {
+        uint32_t c = ch.cells[k];
+        double& h = water[c / width][c % width];
+        double b = h + dt * ch.qin[k] / Ac; // 流出がなければこの水深になる
+        double alpha = sqrt((double)ch.slope[k]) / ch.n;
+        double hn = solveKinematic(b, h, alpha, B, dt / Ac);
+        double vol = (b - hn) * Ac; // 流出量（これで水量が保存される）
+        h = hn;
+
+        if (ch.next[k] != FLOW_NONE) {
+            ch.qin[ch.next[k]] += vol / dt;
+        }
+        else if (ch.outCell[k] != FLOW_NONE) {
+            uint32_t o = ch.outCell[k];
+            water[o / width][o % width] += vol / Ac; // 河道の外は2次元の計算に渡す
+        }
+        else {
+            ch.outVolume += vol;
+        }
+    }
+}
+
+// 岸を超えた水を氾濫原へあふれさせる（広頂堰の式）
+static void spillOverbank(ChannelState& ch, vector<vector<double>>& water, double DT) {
+    const int width = ch.width;
+    const int height = ch.height;
+    const vector<vector<double>>& dem = *ch.dem;
+    const double Ac = w * w;
+
+    for (uint32_t c : ch.cells) {
+        int y = (int)(c / width);
+        int x = (int)(c % width);
+        double over = water[y][x] - ch.bankDepth[c];
+        if (over <= 0.0) continue;
+
+        double eta = dem[y][x] + water[y][x];
+        double part[8];
+        double sum = 0.0;
+        for (int d = 0; d < 8; ++d) {
+            part[d] = 0.0;
+            int nx = x + dxc[d];
+            int ny = y + dyc[d];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+            if (ch.flags->has((size_t)ny * width + nx, CELL_CHANNEL)) continue;
+
+            double H = eta - (dem[ny][nx] + water[ny][nx]); // 越流水深
+            if (H <= 0.0) continue;
+            double q = WEIR_C * w * H * sqrt(H) * DT / Ac;
+            part[d] = min(q, H / 2); // 水面が逆転しないようにする
+            sum += part[d];
+        }
+        if (sum <= 0.0) continue;
+
+        double scale = (sum > over) ? over / sum : 1.0; // 岸より上の水だけ出す
+        for (int d = 0; d < 8; ++d) {
+            if (part[d] <= 0.0) continue;
+            double p = part[d] * scale;
+            water[y][x] -= p;
+            water[y + dyc[d]][x + dxc[d]] += p;
+        }
+        ch.spillVolume += sum * scale * Ac;
+    }
+}
+
+// 1ステップ分の河道の処理
+double channelStep(ChannelState& ch, vector<vector<double>>& water, double DT) {
+    ch.outVolume = 0.0;
+    if (++ch.counter >= ch.interval) {
+        ch.counter = 0;
+        routeChannels(ch, water, DT * ch.interval);
+        ch.outRate = ch.outVolume / (DT * ch.interval);
+    }
+    spillOverbank(ch, water, DT);
+    ch.totalOut += ch.outVolume;
+    return ch.outVolume;
+}
@@ -0,0 +1,54 @@
+﻿#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <vector>
+#include <cstdint>
+#include "streams.h"
+#include "cellflags.h"
+
+using namespace std;
+
+// 1次元の河道（川のセルを河道網の順に並べ、キネマティックウェーブで流す）
+// 河道セルは2次元の計算では流出させず（周りからの流入は受ける）、
+// 水面が岸（隣の地表）を超えたときだけ氾濫原のセルへあふれさせる
+struct ChannelState {
+    int width = 0;
+    int height = 0;
+    const vector<vector<double>>* dem = nullptr; // 標高（あふれの判定用）
+
+    CellFlags* flags = nullptr;  // 河道のセルは CELL_CHANNEL
+    vector<float> bankDepth;     // セルごと：河床から岸までの深さ [m]（河道以外は 0）
+
+    // 河道セルごと（上流から順）
+    vector<uint32_t> cells;      // セル
+    vector<uint32_t> next;       // 下流の河道セル（cells の番号, 河道の外なら FLOW_NONE）
+    vector<uint32_t> outCell;    // 河道の外へ出る場合の流下先のセル（領域外なら FLOW_NONE）
+    vector<float> slope;         // 河床勾配（区間の平均）
+    vector<double> qin;          // 作業用：上流からの流入 [m^3/s]
+
+    double channelWidth = 5.0;   // 川幅 [m]
+    double n = 0.035;            // 河道の粗度係数
+    int interval = 10;           // 何ステップごとに河道を流すか
+    int counter = 0;
+
+    double outVolume = 0.0;      // 直前のステップで領域外へ出た量 [m^3]
+    double outRate = 0.0;        // 直前に河道を流したときの領域外への流量 [m^3/s]
+    double totalOut = 0.0;
+    double spillVolume = 0.0;    // 氾濫原へあふれた量の累計 [m^3]
+};
+
+// 河道の作成（河道網のうち水域のセルを1次元の河道にし、CELL_CHANNEL を付ける）
+ChannelState makeChannel(const StreamNetwork& net, const FlowAccumulation& acc, const vector<vector<double>>& dem, CellFlags& flags);
+
+// 1ステップ分の河道の処理（interval ステップごとに河道を流し、毎ステップあふれを配る）
+// water は河道セルを含む水深の配列。戻り値は領域外へ出た量 [m^3]
+double channelStep(ChannelState& ch, vector<vector<double>>& water, double DT);
+
+// 岸を超えた分の水深（CFL条件用, 河道以外はそのままの水深）
+inline double overbankDepth(const ChannelState& ch, size_t i, double h) {
+    if (!ch.flags->has(i, CELL_CHANNEL)) return h;
+    double d = h - ch.bankDepth[i];
+    return (d > 0.0) ? d : 0.0;
+}
+
+#endif // CHANNEL_H
@@ -0,0 +1,462 @@
+﻿// windows.h は using namespace std; のあるヘッダより前に読む（std::byte と Windows の byte がぶつからないように）
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+#include "checkpoint.h"
+#include "cellflags.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "massbalance.h"
+#include "inflow.h"
+#include "inertial.h"
+#include "decomp.h"
+#include "distributed.h"
+#include "channel.h"
+#include "convergence.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+// ファイルの形式（数値はこのマシンのバイト順のまま）
+//   "RSCK", 版, 設定, ステップ, 時刻
+//   区間の並び：名前（4文字）, バイト数, 中身
+static const char CHECKPOINT_MAGIC[4] = { 'R', 'S', 'C', 'K' };
+static const uint32_t CHECKPOINT_VERSION = 4;
+
+// バッファへの書き込み
+struct ByteWriter {
+    vector<char>& buf;
+
+    void bytes(const void* p, size_t n) {
+        const char* c = (const char*)p;
+        buf.insert(buf.end(), c, c + n);
+    }
+    template <typename T>
+    void value(const T& v) { bytes(&v, sizeof(T)); }
+    template <typename T>
+    void array(const vector<T>& v) {
+        value((uint64_t)v.size());
+        bytes(v.data(), v.size() * sizeof(T));
+    }
+
+    // 区間の始まり（バイト数はあとで書く）
+    size_t begin(const char tag[5]) {
+        bytes(tag, 4);
+        value((uint64_t)0);
+        return buf.size();
+    }
+    void end(size_t start) {
+        uint64_t n = buf.size() - start;
+        memcpy(&buf[start - sizeof(uint64_t)], &n, sizeof(n));
+    }
+};
+
+// バッファからの読み込み（足りなければ ok = false）
+struct ByteReader {
+    const vector<char>& buf;
+    size_t pos = 0;
+    bool ok = true;
+
+    bool bytes(void* p, size_t n) {
+        if (!ok || buf.size() - pos < n) return ok = false;
+        memcpy(p, &buf[pos], n);
+        pos += n;
+        return true;
+    }
+    template <typename T>
+    bool value(T& v) { return bytes(&v, sizeof(T)); }
+    // 要素数が今の配列と同じときだけ読む
+    template <typename T>
+    bool array(vector<T>& v) {
+        uint64_t n = 0;
+        if (!value(n) || n != v.size()) return ok = false;
+        return bytes(v.data(), v.size() * sizeof(T));
+    }
+};
+
+static void writeConfig(ByteWriter& out, const CheckpointConfig& cfg) {
+    out.value(cfg.width);
+    out.value(cfg.height);
+    out.value(cfg.cellSize);
+    out.value(cfg.dt);
+    out.value(cfg.engine);
+    out.value(cfg.routing);
+    out.value(cfg.rainfall);
+    out.value(cfg.domains);
+    out.value(cfg.rank);
+    out.value(cfg.ranks);
+}
+
+static bool readConfig(ByteReader& in, CheckpointConfig& cfg) {
+    in.value(cfg.width);
+    in.value(cfg.height);
+    in.value(cfg.cellSize);
+    in.value(cfg.dt);
+    in.value(cfg.engine);
+    in.value(cfg.routing);
+    in.value(cfg.rainfall);
+    in.value(cfg.domains);
+    in.value(cfg.rank);
+    return in.value(cfg.ranks);
+}
+
+// 違う設定の名前（同じなら nullptr, gridOnly ならグリッドだけ比べる）
+static const char* configMismatch(const CheckpointConfig& a, const CheckpointConfig& b, bool gridOnly) {
+    if (a.width != b.width || a.height != b.height) return "グリッドの大きさ";
+    if (a.cellSize != b.cellSize) return "セルの大きさ";
+    if (gridOnly) return nullptr;
+    if (a.dt != b.dt) return "時間刻み";
+    if (a.engine != b.engine) return "計算エンジン";
+    if (a.routing != b.routing) return "流し方";
+    if (a.rainfall != b.rainfall) return "降雨";
+    if (a.domains != b.domains) return "領域分割の数";
+    if (a.rank != b.rank || a.ranks != b.ranks) return "ランク";
+    return nullptr;
+}
+
+// 状態をバッファに写す
+static void packCheckpoint(vector<char>& buf, const CheckpointConfig& cfg, int step, double time, const CheckpointState& st) {
+    buf.clear();
+    ByteWriter out{ buf };
+    out.bytes(CHECKPOINT_MAGIC, 4);
+    out.value(CHECKPOINT_VERSION);
+    writeConfig(out, cfg);
+    out.value(step);
+    out.value(time);
+
+    if (st.water) {
+        size_t s = out.begin("WATR");
+        out.value((uint64_t)st.water->size());
+        for (const auto& row : *st.water) out.array(row);
+        out.end(s);
+    }
+    if (st.flags) {
+        size_t s = out.begin("FLAG");
+        out.array(st.flags->bits);
+        out.end(s);
+    }
+    if (st.infil) {
+        size_t s = out.begin("INFL");
+        out.array(st.infil->cumInfil);
+        out.array(st.infil->cumRain);
+        out.end(s);
+    }
+    if (st.bflux) {
+        size_t s = out.begin("BFLX");
+        out.bytes(st.bflux->step, sizeof(st.bflux->step));
+        out.bytes(st.bflux->total, sizeof(st.bflux->total));
+        out.end(s);
+    }
+    if (st.ledger) {
+        const MassLedger& l = *st.ledger;
+        size_t s = out.begin("LEDG");
+        out.value(l.started);
+        out.value(l.steps);
+        out.value(l.initialStorage);
+        out.value(l.storage);
+        out.value(l.error);
+        out.value(l.rainIn);
+        out.value(l.inflowIn);
+        out.value(l.infilOut);
+        out.value(l.boundaryOut);
+        out.value(l.clampIn);
+        out.value(l.limited);
+        out.value(l.prevIn);
+        out.value(l.prevOut);
+        out.value(l.wetArea);
+        out.value(l.maxChange);
+        out.value(l.maxDepth);
+        out.end(s);
+    }
+    if (st.inflows) {
+        size_t s = out.begin("INFW");
+        out.value((uint64_t)st.inflows->size());
+        for (const InflowSource& src : *st.inflows) {
+            out.value((uint64_t)src.hydro.cursor);
+            out.value(src.stepVolume);
+            out.value(src.totalVolume);
+        }
+        out.end(s);
+    }
+    if (st.inertial) {
+        size_t s = out.begin("INER");
+        out.array(st.inertial->qx);
+        out.array(st.inertial->qy);
+        out.end(s);
+    }
+    if (st.decomp) {
+        size_t s = out.begin("DECO");
+        out.value((uint64_t)st.decomp->parts.size());
+        for (const Subdomain& p : st.decomp->parts) {
+            out.array(p.qx);
+            out.array(p.qy);
+        }
+        out.end(s);
+    }
+    if (st.dist) {
+        const Subdomain& p = st.dist->local;
+        size_t s = out.begin("DIST");
+        out.array(p.h);
+        out.array(p.flags);
+        out.array(p.infil.cumInfil);
+        out.array(p.infil.cumRain);
+        out.array(p.qx);
+        out.array(p.qy);
+        out.end(s);
+    }
+    if (st.channel) {
+        const ChannelState& ch = *st.channel;
+        size_t s = out.begin("CHAN");
+        out.value(ch.counter);
+        out.value(ch.outVolume);
+        out.value(ch.outRate);
+        out.value(ch.totalOut);
+        out.value(ch.spillVolume);
+        out.end(s);
+    }
+    if (st.monitor) {
+        const ConvergenceMonitor& m = *st.monitor;
+        size_t s = out.begin("CONV");
+        out.value(m.phase);
+        out.value(m.quietSteps);
+        out.value(m.hasPrev);
+        out.value(m.prevStorage);
+        out.value(m.prevWetArea);
+        out.value(m.storageRate);
+        out.value(m.wetRate);
+        out.end(s);
+    }
+}
+
+// 一時ファイルに書いてから名前を変える
+static bool writeFile(const string& path, const vector<char>& buf) {
+    string tmp = path + ".tmp";
+    {
+        ofstream file(tmp, ios::binary | ios::trunc);
+        if (!file) return false;
+        file.write(buf.data(), (streamsize)buf.size());
+        if (!file) return false;
+    }
+    // 前のチェックポイントを消さずに置き換える（Windows の rename は上書きしないので MoveFileEx を使う）
+#ifdef _WIN32
+    return MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    if (worker.joinable()) worker.join();
+}
+
+// 状態をバッファに写して、別スレッドで書き出す
+void saveCheckpoint(CheckpointWriter& cw, const CheckpointConfig& cfg, int step, double time, const CheckpointState& st) {
+    // 書き出し中でないほうのバッファに写す（前の書き出しと重なってよい）
+    vector<char>& buf = cw.buffer[cw.next];
+    packCheckpoint(buf, cfg, step, time, st);
+
+    // 前の書き出しが終わってから次を始める
+    if (!finishCheckpoint(cw)) {
+        cerr << "チェックポイントを書き出せませんでした: " << cw.path << endl;
+    }
+    cw.worker = thread([&cw, &buf]() { cw.ok = writeFile(cw.path, buf); });
+    cw.next ^= 1;
+}
+
+bool finishCheckpoint(CheckpointWriter& cw) {
+    if (cw.worker.joinable()) cw.worker.join();
+    return cw.ok;
+}
+
+// チェックポイントを読み込んで st の状態を戻す
+static bool readCheckpoint(const string& path, const CheckpointConfig& cfg, bool gridOnly, int& step, double& time, const CheckpointState& st) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        cerr << "チェックポイントを開けません: " << path << endl;
+        return false;
+    }
+    vector<char> buf((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    ByteReader in{ buf };
+    char magic[4];
+    uint32_t version = 0;
+    in.bytes(magic, 4);
+    in.value(version);
+    if (!in.ok || memcmp(magic, CHECKPOINT_MAGIC, 4) != 0 || version != CHECKPOINT_VERSION) {
+        cerr << "チェックポイントの形式が違います: " << path << endl;
+        return false;
+    }
+    CheckpointConfig saved;
+    readConfig(in, saved);
+    const char* diff = in.ok ? configMismatch(saved, cfg, gridOnly) : nullptr;
+    if (diff) {
+        cerr << "チェックポイントと設定が違います（" << diff << "）: " << path << endl;
+        return false;
+    }
+    int savedStep = 0;
+    double savedTime = 0.0;
+    in.value(savedStep);
+    in.value(savedTime);
+
+    // 区間を順に読む（使う状態の区間はすべてそろっていること）
+    bool found[11] = {};
+    while (in.ok && in.pos < buf.size()) {
+        char tag[4];
+        uint64_t size = 0;
+        in.bytes(tag, 4);
+        in.value(size);
+        if (!in.ok || buf.size() - in.pos < size) {
+            in.ok = false;
+            break;
+        }
+        const size_t end = in.pos + (size_t)size;
+
+        if (memcmp(tag, "WATR", 4) == 0 && st.water) {
+            uint64_t rows = 0;
+            in.value(rows);
+            if (rows != st.water->size()) in.ok = false;
+            for (auto& row : *st.water) in.array(row);
+            found[0] = true;
+        }
+        else if (memcmp(tag, "FLAG", 4) == 0 && st.flags) {
+            in.array(st.flags->bits);
+            found[1] = true;
+        }
+        else if (memcmp(tag, "INFL", 4) == 0 && st.infil) {
+            in.array(st.infil->cumInfil);
+            in.array(st.infil->cumRain);
+            found[2] = true;
+        }
+        else if (memcmp(tag, "BFLX", 4) == 0 && st.bflux) {
+            in.bytes(st.bflux->step, sizeof(st.bflux->step));
+            in.bytes(st.bflux->total, sizeof(st.bflux->total));
+            found[3] = true;
+        }
+        else if (memcmp(tag, "LEDG", 4) == 0 && st.ledger) {
+            MassLedger& l = *st.ledger;
+            in.value(l.started);
+            in.value(l.steps);
+            in.value(l.initialStorage);
+            in.value(l.storage);
+            in.value(l.error);
+            in.value(l.rainIn);
+            in.value(l.inflowIn);
+            in.value(l.infilOut);
+            in.value(l.boundaryOut);
+            in.value(l.clampIn);
+            in.value(l.limited);
+            in.value(l.prevIn);
+            in.value(l.prevOut);
+            in.value(l.wetArea);
+            in.value(l.maxChange);
+            in.value(l.maxDepth);
+            found[4] = true;
+        }
+        else if (memcmp(tag, "INFW", 4) == 0 && st.inflows) {
+            uint64_t count = 0;
+            in.value(count);
+            if (count != st.inflows->size()) in.ok = false;
+            for (InflowSource& src : *st.inflows) {
+                uint64_t cursor = 0;
+                in.value(cursor);
+                in.value(src.stepVolume);
+                in.value(src.totalVolume);
+                src.hydro.cursor = (size_t)cursor;
+            }
+            found[5] = true;
+        }
+        else if (memcmp(tag, "INER", 4) == 0 && st.inertial) {
+            in.array(st.inertial->qx);
+            in.array(st.inertial->qy);
+            found[6] = true;
+        }
+        else if (memcmp(tag, "DECO", 4) == 0 && st.decomp) {
+            uint64_t parts = 0;
+            in.value(parts);
+            if (parts != st.decomp->parts.size()) in.ok = false;
+            for (Subdomain& p : st.decomp->parts) {
+                in.array(p.qx);
+                in.array(p.qy);
+            }
+            found[7] = true;
+        }
+        else if (memcmp(tag, "DIST", 4) == 0 && st.dist) {
+            Subdomain& p = st.dist->local;
+            in.array(p.h);
+            in.array(p.flags);
+            in.array(p.infil.cumInfil);
+            in.array(p.infil.cumRain);
+            in.array(p.qx);
+            in.array(p.qy);
+            found[8] = true;
+        }
+        else if (memcmp(tag, "CHAN", 4) == 0 && st.channel) {
+            ChannelState& ch = *st.channel;
+            in.value(ch.counter);
+            in.value(ch.outVolume);
+            in.value(ch.outRate);
+            in.value(ch.totalOut);
+            in.value(ch.spillVolume);
+            found[9] = true;
+        }
+        else if (memcmp(tag, "CONV", 4) == 0 && st.monitor) {
+            ConvergenceMonitor& m = *st.monitor;
+            in.value(m.phase);
+            in.value(m.quietSteps);
+            in.value(m.hasPrev);
+            in.value(m.prevStorage);
+            in.value(m.prevWetArea);
+            in.value(m.storageRate);
+            in.value(m.wetRate);
+            found[10] = true;
+        }
+        if (in.ok && in.pos != end) {
+            if (in.pos > end) in.ok = false;
+            in.pos = end; // 使わない区間は読み飛ばす
+        }
+    }
+
+    const bool used[11] = { st.water != nullptr, st.flags != nullptr, st.infil != nullptr, st.bflux != nullptr, st.ledger != nullptr,
+                            st.inflows != nullptr, st.inertial != nullptr, st.decomp != nullptr, st.dist != nullptr, st.channel != nullptr,
+                            st.monitor != nullptr };
+    for (int i = 0; i < 11 && in.ok; ++i) {
+        if (used[i] && !found[i]) in.ok = false;
+    }
+    if (!in.ok) {
+        cerr << "チェックポイントが壊れているか、保存した状態が足りません: " << path << endl;
+        return false;
+    }
+
+    step = savedStep;
+    time = savedTime;
+    return true;
+}
+
+bool loadCheckpoint(const string& path, const CheckpointConfig& cfg, int& step, double& time, const CheckpointState& st) {
+    return readCheckpoint(path, cfg, false, step, time, st);
+}
+
+// チェックポイントの水深だけ読む
+bool loadCheckpointWater(const string& path, int width, int height, double cellSize, vector<vector<double>>& water) {
+    CheckpointConfig cfg;
+    cfg.width = width;
+    cfg.height = height;
+    cfg.cellSize = cellSize;
+    CheckpointState st;
+    st.water = &water;
+    int step = 0;
+    double time = 0.0;
+    return readCheckpoint(path, cfg, true, step, time, st);
+}
+
+// チェックポイントのファイルか（先頭の4バイトで見分ける）
+bool isCheckpointFile(const string& path) {
+    ifstream file(path, ios::binary);
+    char magic[4] = {};
+    file.read(magic, 4);
+    return file && memcmp(magic, CHECKPOINT_MAGIC, 4) == 0;
+}
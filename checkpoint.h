@@ -0,0 +1,85 @@
+﻿#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// チェックポイント（途中経過の保存と再開）
+// 一定ステップごとに計算の状態をバイナリで保存し、river_sim --restart [ファイル] でその続きから計算する
+// 保存するもの：水深、セルのフラグ、浸透の累積、境界・流入点・河道の累積量、水収支の帳簿、局所慣性近似の面の流量、収束の判定、ステップと時刻
+// （MPI のときは各ランクが自分の帯の水深・フラグ・浸透の累積だけを保存する）
+// （流向と多方向流の配分表は再開後の最初のステップで水面から作り直すので保存しない）
+// 保存は2つのバッファに交互に写してから別スレッドで書き出すので、書き出しの間も計算を続けられる
+// 書き出しは一時ファイルに書いてから名前を変えるので、途中で止まっても前のチェックポイントは壊れない
+// 再開した計算は、止めずに計算した場合とビット単位で同じ結果になる
+
+struct CellFlags;
+struct InfiltrationState;
+struct BoundaryFlux;
+struct MassLedger;
+struct InflowSource;
+struct InertialState;
+struct DomainDecomposition;
+struct DistributedDomain;
+struct ChannelState;
+struct ConvergenceMonitor;
+
+// 計算の設定（保存したときと違えば再開しない）
+struct CheckpointConfig {
+    int width = 0;
+    int height = 0;
+    double cellSize = 0.0; // セルの大きさ [m]
+    double dt = 0.0;       // 1ステップの秒数
+    int engine = 0;        // SolverEngine
+    int routing = 0;       // RoutingMode
+    double rainfall = 0.0; // 1ステップの降雨 [m]（雨は一定なので、降雨の位置はステップ数で決まる）
+    int domains = 1;       // 領域分割の数
+    int rank = 0;          // MPI のランク（ランクごとに別のファイル）
+    int ranks = 1;
+};
+
+// 保存・復元する状態（使っていないものは nullptr）
+struct CheckpointState {
+    vector<vector<double>>* water = nullptr;
+    CellFlags* flags = nullptr;
+    InfiltrationState* infil = nullptr;
+    BoundaryFlux* bflux = nullptr;
+    MassLedger* ledger = nullptr;
+    vector<InflowSource>* inflows = nullptr;
+    InertialState* inertial = nullptr;
+    DomainDecomposition* decomp = nullptr;
+    DistributedDomain* dist = nullptr;
+    ChannelState* channel = nullptr;
+    ConvergenceMonitor* monitor = nullptr;
+};
+
+// 非同期の書き出し（バッファ2つ）
+struct CheckpointWriter {
+    string path;          // 保存先
+    vector<char> buffer[2];
+    int next = 0;         // 次に写すバッファ
+    thread worker;        // 書き出し中のスレッド
+    bool ok = true;       // 直前の書き出しが成功したか
+
+    ~CheckpointWriter();
+};
+
+// 状態をバッファに写して、別スレッドで書き出す（前の書き出しが終わっていなければ待つ）
+void saveCheckpoint(CheckpointWriter& cw, const CheckpointConfig& cfg, int step, double time, const CheckpointState& st);
+
+// 書き出しが終わるのを待つ（戻り値は最後の書き出しが成功したか）
+bool finishCheckpoint(CheckpointWriter& cw);
+
+// チェックポイントを読み込んで状態を戻す（step: 終わっているステップ数, 設定が違うか壊れていれば false）
+bool loadCheckpoint(const string& path, const CheckpointConfig& cfg, int& step, double& time, const CheckpointState& st);
+
+// チェックポイントの水深だけ読む（グリッドの大きさだけ確かめる, 別の設定の計算の初期水深にする用）
+bool loadCheckpointWater(const string& path, int width, int height, double cellSize, vector<vector<double>>& water);
+
+// チェックポイントのファイルか
+bool isCheckpointFile(const string& path);
+
+#endif // CHECKPOINT_H
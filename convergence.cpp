@@ -0,0 +1,39 @@
+﻿#include "convergence.h"
+#include <cmath>
+#include <algorithm>
+
+// ステップごとに状態を更新する
+RunPhase updateConvergence(ConvergenceMonitor& m, const MassLedger& ledger) {
+    const ConvergenceOptions& o = m.opt;
+
+    // 貯留量と浸水面積はステップ開始時の値なので、直前のステップとの差が1ステップ分の変化
+    bool quiet = false;
+    if (m.hasPrev) {
+        m.storageRate = fabs(ledger.storage - m.prevStorage) / max(ledger.storage, o.drainedVolume);
+        m.wetRate = fabs(ledger.wetArea - m.prevWetArea);
+        quiet = (ledger.maxChange < o.maxChange && m.storageRate < o.storageChange && m.wetRate <= o.wetChange);
+    }
+    m.prevStorage = ledger.storage;
+    m.prevWetArea = ledger.wetArea;
+    m.hasPrev = true;
+
+    m.quietSteps = quiet ? m.quietSteps + 1 : 0;
+    if (ledger.storage < o.drainedVolume && ledger.maxChange < o.maxChange) {
+        m.phase = RunPhase::Drained;
+    }
+    else if (m.quietSteps >= o.window) {
+        m.phase = RunPhase::Steady;
+    }
+    else {
+        m.phase = RunPhase::Running;
+    }
+    return m.phase;
+}
+
+const char* runPhaseName(RunPhase phase) {
+    switch (phase) {
+    case RunPhase::Steady: return "定常";
+    case RunPhase::Drained: return "水が抜けきった";
+    default: return "変化中";
+    }
+}
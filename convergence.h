@@ -0,0 +1,55 @@
+﻿#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include "massbalance.h"
+
+using namespace std;
+
+// 収束の判定（定常になったか、水が抜けきったか）
+// 水収支の帳簿にソルバーのループの中で集計した値（水深の変化の最大値・貯留量・浸水面積）だけを使うので、全セルを回し直さない
+// 雨や流入のハイドログラフがあとで変わる計算では、定常の判定で止めないこと
+
+// 計算の状態
+enum class RunPhase {
+    Running, // 変化している
+    Steady,  // 定常（変化が閾値未満のステップが window 回続いた）
+    Drained  // 水が抜けきった
+};
+
+// 定常・水が抜けきったときの動作
+enum class SteadyAction {
+    None,        // 何もしない（最後まで計算する）
+    Stop,        // そこで計算を終える
+    CoarseOutput // 画像の保存の間隔を広げる（変化し始めたら元に戻す）
+};
+
+struct ConvergenceOptions {
+    double maxChange = 1e-5;      // 1ステップの水深の変化の最大値 [m]
+    double storageChange = 1e-7;  // 1ステップの貯留量の変化（貯留量に対する割合）
+    double wetChange = 0.0;       // 1ステップの浸水面積の変化 [m^2]
+    int window = 200;             // 続けて閾値未満になったステップ数
+    double drainedVolume = 1.0;   // これ未満の貯留量は水が抜けきったとみなす [m^3]
+};
+
+struct ConvergenceMonitor {
+    ConvergenceOptions opt;
+    RunPhase phase = RunPhase::Running;
+    int quietSteps = 0; // 閾値未満が続いているステップ数
+
+    // 直前のステップ（最初のステップでは比べない）
+    bool hasPrev = false;
+    double prevStorage = 0.0;
+    double prevWetArea = 0.0;
+
+    // 最新のステップの変化
+    double storageRate = 0.0; // 貯留量の変化の割合
+    double wetRate = 0.0;     // 浸水面積の変化 [m^2]
+};
+
+// ステップごとに呼んで状態を更新する（finishLedgerStep のあと）
+RunPhase updateConvergence(ConvergenceMonitor& m, const MassLedger& ledger);
+
+// 状態の名前（表示用）
+const char* runPhaseName(RunPhase phase);
+
+#endif // CONVERGENCE_H
@@ -0,0 +1,405 @@
+﻿#include "decomp.h"
+#include "inertial.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "inflow.h"
+#include "massbalance.h"
+#include "cellflags.h"
+#include <cmath>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const double g = 9.81; // 重力加速度 [m/s^2]
+
+
+// 使えるスレッドの数
+static int maxThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// 小領域の作成
+Subdomain makeSubdomain(const vector<vector<double>>& dem, int width, int height, int y0, int y1, int threads) {
+    const int W = width;
+    Subdomain s;
+    s.y0 = y0;
+    s.y1 = y1;
+    const int rows = s.rows();
+
+    s.threads = (threads > 0) ? threads : maxThreads();
+    s.tiles = makeTileGrid(W, rows, 4 * sizeof(double)); // z, h, qx, qy
+    s.tileMax.assign(s.tiles.count(), 0.0);
+    s.tileSum.assign(s.tiles.count(), 0.0);
+    s.tileClamp.assign(s.tiles.count(), 0.0);
+    s.tileWet.assign(s.tiles.count(), 0);
+
+    s.z.assign((size_t)(rows + 2) * W, 0.0);
+    s.h.assign((size_t)(rows + 2) * W, 0.0);
+    s.qx.assign((size_t)rows * (W + 1), 0.0);
+    s.qy.assign((size_t)(rows + 1) * W, 0.0);
+    s.h0.assign((size_t)rows * W, 0.0);
+
+    // 標高はハローも含めて写す（外周の外は自分の行で代用する）
+    for (int r = 0; r < rows + 2; ++r) {
+        int y = min(max(y0 + r - 1, 0), height - 1);
+        for (int x = 0; x < W; ++x) s.z[(size_t)r * W + x] = dem[y][x];
+    }
+    return s;
+}
+
+// 全体の配列から小領域に写す
+void loadSubdomain(Subdomain& s, int width, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil) {
+    const int W = width;
+    for (int r = 1; r <= s.rows(); ++r) {
+        copy(water[s.y0 + r - 1].begin(), water[s.y0 + r - 1].end(), s.h.begin() + (size_t)r * W);
+    }
+
+    const size_t first = (size_t)s.y0 * W;
+    const size_t last = (size_t)s.y1 * W;
+    if (flags) s.flags.assign(flags->bits.begin() + first, flags->bits.begin() + last);
+    else s.flags.clear();
+
+    if (infil) {
+        s.infil.model = infil->model;
+        s.infil.width = W;
+        s.infil.height = s.rows();
+        s.infil.classes = infil->classes;
+        s.infil.coef = infil->coef;
+        s.infil.soilClass.assign(infil->soilClass.begin() + first, infil->soilClass.begin() + last);
+        s.infil.cumInfil.assign(infil->cumInfil.begin() + first, infil->cumInfil.begin() + last);
+        if (!infil->cumRain.empty()) s.infil.cumRain.assign(infil->cumRain.begin() + first, infil->cumRain.begin() + last);
+        else s.infil.cumRain.clear();
+    }
+    else {
+        s.infil = InfiltrationState();
+    }
+}
+
+// 小領域から全体の配列に書き戻す
+void storeSubdomain(const Subdomain& s, int width, vector<vector<double>>& water, CellFlags* flags, InfiltrationState* infil) {
+    const int W = width;
+    for (int r = 1; r <= s.rows(); ++r) {
+        copy(s.h.begin() + (size_t)r * W, s.h.begin() + (size_t)(r + 1) * W, water[s.y0 + r - 1].begin());
+    }
+
+    const size_t first = (size_t)s.y0 * W;
+    if (flags && !s.flags.empty()) copy(s.flags.begin(), s.flags.end(), flags->bits.begin() + first);
+    if (infil && !s.infil.cumInfil.empty()) {
+        copy(s.infil.cumInfil.begin(), s.infil.cumInfil.end(), infil->cumInfil.begin() + first);
+        if (!s.infil.cumRain.empty()) copy(s.infil.cumRain.begin(), s.infil.cumRain.end(), infil->cumRain.begin() + first);
+    }
+}
+
+// 領域分割の作成
+DomainDecomposition makeDecomposition(const vector<vector<double>>& dem, int width, int height, int parts) {
+    DomainDecomposition dd;
+    dd.width = width;
+    dd.height = height;
+    const int P = max(1, min(parts, height));
+    dd.parts.resize(P);
+
+    // 小領域ごとのグループの中でもスレッドを分けられるように、入れ子の並列を2段まで許す
+    const int threads = max(1, maxThreads() / P);
+#if defined(_OPENMP) && _OPENMP >= 200805
+    omp_set_max_active_levels(2);
+#elif defined(_OPENMP)
+    omp_set_nested(1);
+#endif
+
+    // 小領域 p は p 番目のグループが確保して初期化する（計算と同じ forEachGroup なので毎回同じ場所のスレッドになる）
+    // グループの中のスレッドは近くに置く（proc_bind(close)）ので、同じソケットのメモリを使う
+    forEachGroup(P, [&](int p) {
+        int y0 = (int)((long long)height * p / P);
+        int y1 = (int)((long long)height * (p + 1) / P);
+        dd.parts[p] = makeSubdomain(dem, width, height, y0, y1, threads);
+    });
+    return dd;
+}
+
+// 全部の小領域に写す（小領域 p の配列は p 番目のグループが確保したので、同じグループで写す）
+void loadDecomposition(DomainDecomposition& dd, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil) {
+    forEachGroup((int)dd.parts.size(), [&](int p) {
+        loadSubdomain(dd.parts[p], dd.width, water, flags, infil);
+    });
+    dd.loaded = true;
+}
+
+// 全部の小領域から書き戻す
+void storeDecomposition(const DomainDecomposition& dd, vector<vector<double>>& water, CellFlags* flags, InfiltrationState* infil) {
+    if (!dd.loaded) return; // まだ計算していなければ全体の配列の方が新しい
+    forEachGroup((int)dd.parts.size(), [&](int p) {
+        storeSubdomain(dd.parts[p], dd.width, water, flags, infil);
+    });
+}
+
+// 流入を小領域の水深に加える
+double applySubdomainInflows(vector<InflowSource>& sources, Subdomain* parts, int count, int width, double time, double DT) {
+    const double cellArea = w * w;
+    double total = 0.0;
+
+    for (auto& src : sources) {
+        double volume = advanceInflow(src, time, DT);
+        for (size_t k = 0; k < src.cells.size(); ++k) {
+            const int y = src.cells[k].first;
+            const int x = src.cells[k].second;
+            for (int p = 0; p < count; ++p) {
+                Subdomain& s = parts[p];
+                if (y < s.y0 || y >= s.y1) continue;
+                s.h[(size_t)(y - s.y0 + 1) * width + x] += volume * src.weights[k] / cellArea;
+                break;
+            }
+        }
+        total += volume;
+    }
+    return total;
+}
+
+// 境目のハローに隣の小領域の水深を写す
+static void exchangeHalo(DomainDecomposition& dd, int p) {
+    const int W = dd.width;
+    Subdomain& s = dd.parts[p];
+    if (p > 0) {
+        const Subdomain& up = dd.parts[p - 1];
+        copy(up.h.begin() + (size_t)up.rows() * W, up.h.begin() + (size_t)(up.rows() + 1) * W, s.h.begin());
+    }
+    if (p + 1 < (int)dd.parts.size()) {
+        const Subdomain& down = dd.parts[p + 1];
+        copy(down.h.begin() + W, down.h.begin() + 2 * (size_t)W, s.h.begin() + (size_t)(s.rows() + 1) * W);
+    }
+}
+
+// ステップ開始時の水深を控える（貯留量 [m] を返し、最大水深を s.hmax に入れる）
+double subdomainBegin(Subdomain& s, int width, double hmin, int& wet) {
+    const int W = width;
+    forEachTile(s.tiles, s.threads, [&](const Tile& t) {
+        KahanSum storage;
+        double m = 0.0;
+        int tileWet = 0;
+        for (int y = t.y0; y < t.y1; ++y) {
+            const double* hr = &s.h[(size_t)(y + 1) * W];
+            double* h0r = &s.h0[(size_t)y * W];
+            for (int x = t.x0; x < t.x1; ++x) {
+                h0r[x] = hr[x];
+                storage.add(hr[x]);
+                m = max(m, hr[x]);
+            }
+            if (!s.flags.empty()) tileWet += updateDryRow(&s.flags[(size_t)y * W + t.x0], hr + t.x0, t.x1 - t.x0, hmin);
+        }
+        s.tileSum[t.index] = storage.sum;
+        s.tileMax[t.index] = m;
+        s.tileWet[t.index] = tileWet;
+    });
+
+    // タイルの順に足す（スレッドの数によらず同じ結果）
+    KahanSum storage;
+    double m = 0.0;
+    wet = 0;
+    for (int k = 0; k < s.tiles.count(); ++k) {
+        storage.add(s.tileSum[k]);
+        m = max(m, s.tileMax[k]);
+        wet += s.tileWet[k];
+    }
+    s.hmax = m;
+    s.clamp = 0.0;
+    for (int e = 0; e < 4; ++e) s.edgeVolume[e] = 0.0;
+    return storage.sum;
+}
+
+// 内部の面（タイルの各行で x方向の面と北側の y方向の面を続けて更新する, inertial.cpp と同じ）
+// 小領域の行 1 の北側の面（面 0）はハローを使うので、ここでは計算しない
+void subdomainInteriorFaces(Subdomain& s, int width, double n2, double dt, double hmin) {
+    const int W = width;
+    const double* z = s.z.data();
+    const double* h = s.h.data();
+    forEachTile(s.tiles, s.threads, [&](const Tile& t) {
+        const int xa = max(t.x0, 1);
+        for (int y = t.y0; y < t.y1; ++y) {
+            const int r = y + 1;
+            const double* z1 = z + (size_t)r * W;
+            const double* h1 = h + (size_t)r * W;
+            inertialXFaceRow(s.qx.data() + (size_t)y * (W + 1), z1, h1, xa, t.x1, n2, dt, hmin);
+            if (r > 1) inertialYFaceRow(s.qy.data() + (size_t)y * W, z1 - W, h1 - W, z1, h1, t.x0, t.x1, n2, dt, hmin);
+        }
+    });
+}
+
+// y方向の面 k0..k1
+void subdomainYFaces(Subdomain& s, int width, int k0, int k1, double n2, double dt, double hmin) {
+    const int W = width;
+    for (int k = k0; k <= k1; ++k) {
+        const double* z0 = s.z.data() + (size_t)k * W;
+        const double* h0 = s.h.data() + (size_t)k * W;
+        inertialYFaceRow(s.qy.data() + (size_t)k * W, z0, h0, z0 + W, h0 + W, 0, W, n2, dt, hmin);
+    }
+}
+
+// 外周の面と水深の更新
+double subdomainUpdate(Subdomain& s, int width, bool north, bool south, double dt, double DT, double n, double hmin, bool last, const FlowOptions& opts) {
+    const int W = width;
+    const int rows = s.rows();
+    const double* z = s.z.data();
+    double* h = s.h.data();
+    double* qx = s.qx.data();
+    double* qy = s.qy.data();
+
+    // 外周の面（北端・南端は端の小領域だけ, 西端・東端は受け持つ行だけ）
+    if (opts.boundary) {
+        for (int e = 0; e < 4; ++e) {
+            const EdgeBoundary& b = opts.boundary->edge[e];
+            if (b.type == BoundaryType::Closed) continue;
+            if (e == EDGE_NORTH && !north) continue;
+            if (e == EDGE_SOUTH && !south) continue;
+
+            bool horizontal = (e == EDGE_NORTH || e == EDGE_SOUTH);
+            int count = horizontal ? W : rows;
+            for (int i = 0; i < count; ++i) {
+                size_t cell, inner;
+                double* q;
+                double sign; // 外向きの符号
+                if (e == EDGE_NORTH) { cell = (size_t)W + i; inner = cell + W; q = &qy[i]; sign = -1.0; }
+                else if (e == EDGE_SOUTH) { cell = (size_t)rows * W + i; inner = cell - W; q = &qy[(size_t)rows * W + i]; sign = 1.0; }
+                else if (e == EDGE_WEST) { cell = (size_t)(i + 1) * W; inner = cell + 1; q = &qx[(size_t)i * (W + 1)]; sign = -1.0; }
+                else { cell = (size_t)(i + 1) * W + W - 1; inner = cell - 1; q = &qx[(size_t)i * (W + 1) + W]; sign = 1.0; }
+
+                s.edgeVolume[e] += updateEdgeFace(b, *q, sign, h[cell], z[cell], z[inner], n, dt, hmin);
+            }
+        }
+    }
+
+    // 水深の更新（最後の分割で降雨と浸透も同じループで入れる）
+    // 浸透は小領域が持つ受け持ちの行の状態を使う（浸透を計算しなければ空）
+    const double rain = opts.rainfall;
+    InfiltrationState* infil = s.infil.cumInfil.empty() ? nullptr : &s.infil;
+    const bool source = last && (rain > 0.0 || infil != nullptr);
+    forEachTile(s.tiles, s.threads, [&](const Tile& t) {
+        InertialUpdateSums sums;
+        for (int y = t.y0; y < t.y1; ++y) {
+            const double* qyN = qy + (size_t)y * W;       // 北側の面
+            const double* qyS = qy + (size_t)(y + 1) * W; // 南側の面
+            inertialUpdateRow(h + (size_t)(y + 1) * W, qx + (size_t)y * (W + 1), qyN, qyS, t.x0, t.x1,
+                              dt, DT, source, rain, infil, (size_t)y * W, sums);
+        }
+        s.tileMax[t.index] = sums.hmax;
+        s.tileClamp[t.index] = sums.clamp;
+        s.tileSum[t.index] = sums.infil.sum;
+    });
+
+    KahanSum infilSum;
+    double m = 0.0;
+    for (int k = 0; k < s.tiles.count(); ++k) {
+        infilSum.add(s.tileSum[k]);
+        m = max(m, s.tileMax[k]);
+        s.clamp += s.tileClamp[k];
+    }
+    s.hmax = m;
+    return infilSum.sum;
+}
+
+// ステップ開始時の水深との差の最大値
+double subdomainMaxChange(Subdomain& s, int width) {
+    const int W = width;
+    forEachTile(s.tiles, s.threads, [&](const Tile& t) {
+        double dh = 0.0;
+        for (int y = t.y0; y < t.y1; ++y) {
+            const double* hr = &s.h[(size_t)(y + 1) * W];
+            const double* h0r = &s.h0[(size_t)y * W];
+            for (int x = t.x0; x < t.x1; ++x) {
+                dh = max(dh, fabs(hr[x] - h0r[x]));
+            }
+        }
+        s.tileMax[t.index] = dh;
+    });
+    return *max_element(s.tileMax.begin(), s.tileMax.end());
+}
+
+// 領域分割で DT 秒進める
+void simulateDecomposed(vector<vector<double>>& water, DomainDecomposition& dd, double DT, double n, const FlowOptions& opts) {
+    const int W = dd.width;
+    const int H = dd.height;
+    const int P = (int)dd.parts.size();
+
+    MassLedger* ledger = opts.ledger;
+    if (ledger) beginLedgerStep(*ledger, P);
+
+    // 最初のステップで水深・フラグ・浸透の状態を小領域に写す（その後は小領域が持ち続ける）
+    if (!dd.loaded) loadDecomposition(dd, water, opts.flags, opts.infil);
+
+    // ステップ開始時の水深を控える（水収支の貯留量と最大水深もここで求める）
+    // 小領域ごとにスレッドのグループを割り当て、グループの中でタイルに分ける（入れ子の並列）
+    forEachGroup(P, [&](int p) {
+        Subdomain& s = dd.parts[p];
+        int wet = 0;
+        double storage = subdomainBegin(s, W, dd.hmin, wet);
+        if (ledger) {
+            ledger->parts[p].storage = storage;
+            ledger->parts[p].wet = wet;
+            ledger->parts[p].hmax = s.hmax;
+        }
+    });
+    double hmax = 0.0;
+    for (const Subdomain& s : dd.parts) hmax = max(hmax, s.hmax);
+
+    // CFL条件から分割数を決める（全体で同じ時間刻み）
+    double dtMax = (hmax > dd.hmin) ? dd.alpha * w / sqrt(g * hmax) : DT;
+    int nsub = max(1, (int)ceil(DT / dtMax));
+    double dt = DT / nsub;
+    dd.substeps = nsub;
+
+    for (int st = 0; st < nsub; ++st) {
+        bool last = (st == nsub - 1);
+
+        // ハローの交換（隣の小領域は受け持ちの行を書き換えていないので、コピーだけで済む）
+        forEachGroup(P, [&](int p) {
+            exchangeHalo(dd, p);
+        });
+
+        // 小領域ごとに面の流量と水深を更新する
+        forEachGroup(P, [&](int p) {
+            Subdomain& s = dd.parts[p];
+            const bool north = (p == 0);
+            const bool south = (p == P - 1);
+            subdomainInteriorFaces(s, W, n * n, dt, dd.hmin);
+            if (!north) subdomainYFaces(s, W, 0, 0, n * n, dt, dd.hmin); // 境目の面は両側の小領域が同じ値を計算する
+            if (!south) subdomainYFaces(s, W, s.rows(), s.rows(), n * n, dt, dd.hmin);
+            double infilSum = subdomainUpdate(s, W, north, south, dt, DT, n, dd.hmin, last, opts);
+            if (last && ledger) ledger->parts[p].infil = infilSum;
+        });
+    }
+
+    // ステップ開始時の水深との差の最大値（water には書き戻さない）
+    forEachGroup(P, [&](int p) {
+        Subdomain& s = dd.parts[p];
+        double dh = subdomainMaxChange(s, W);
+        if (ledger) {
+            ledger->parts[p].clamp = s.clamp;
+            ledger->parts[p].dhmax = dh;
+        }
+    });
+
+    // 境界からの流出量
+    double boundaryVolume = 0.0;
+    for (int e = 0; e < 4; ++e) {
+        double v = 0.0;
+        for (const Subdomain& s : dd.parts) v += s.edgeVolume[e];
+        if (opts.bflux) {
+            opts.bflux->step[e] = v;
+            opts.bflux->total[e] += v;
+        }
+        boundaryVolume += v;
+    }
+
+    // 上流からの流入（流入点のセルを受け持つ小領域の水深に加える）
+    double inflowVolume = 0.0;
+    if (opts.inflows) {
+        inflowVolume = applySubdomainInflows(*opts.inflows, dd.parts.data(), P, W, opts.time, DT);
+    }
+
+    if (ledger) {
+        finishLedgerStep(*ledger, w * w, opts.rainfall * w * w * W * H, inflowVolume, boundaryVolume, 0);
+    }
+}
@@ -0,0 +1,97 @@
+﻿#ifndef DECOMP_H
+#define DECOMP_H
+
+#include <vector>
+#include "simulate.h"
+#include "infiltration.h"
+#include "tiling.h"
+
+using namespace std;
+
+// 局所慣性近似の領域分割
+// グリッドを横長の帯（小領域）に分け、小領域ごとに自分の配列を持ってスレッドのグループで計算する
+// 外側のグループはソケットに散らし（proc_bind(spread)）、グループの中ではタイルを近くのスレッドに分ける（proc_bind(close)）
+// 配列はそのグループが最初に書き込む（first touch）ので、OMP_PLACES=sockets などとすれば
+// メモリも同じソケットに置かれ、帯域がソケット数に比例する（スレッドの数は OMP_NUM_THREADS を帯の数で割ったもの）
+// 隣の小領域の境目の1行（ハロー）の水深は、分割した時間刻みごとに共有メモリからコピーする
+// 水深・セルのフラグ・浸透の状態はステップをまたいで小領域が持ち続け、全体の配列（water など）には
+// 画像やチェックポイントの保存の前に storeDecomposition で書き戻す（毎ステップ全体の配列を通さない）
+
+// 小領域（行 y0..y1-1 を受け持ち、上下に1行ずつハローを持つ）
+// z, h の行 r はグリッドの行 y0 + r - 1（r = 0 と r = rows + 1 がハロー）
+struct Subdomain {
+    int y0 = 0;
+    int y1 = 0;
+    int rows() const { return y1 - y0; }
+
+    vector<double> z;  // 標高 (rows + 2) * width
+    vector<double> h;  // 水深 (rows + 2) * width
+    vector<double> qx; // x方向の面の流量 rows * (width + 1)
+    vector<double> qy; // y方向の面の流量 (rows + 1) * width（面 k は行 r = k と k + 1 の間）
+    vector<double> h0; // ステップ開始時の水深 rows * width（水深の変化の最大値用）
+
+    vector<uint8_t> flags;   // 受け持つ行のセルのフラグ rows * width
+    InfiltrationState infil; // 受け持つ行の浸透の状態（浸透を計算しないときは空）
+
+    int threads = 1;          // 小領域を計算するスレッドの数（グループの中のチーム）
+    TileGrid tiles;           // 受け持つ行のタイル分割（タイルの行 y は小領域の行 r = y + 1）
+    vector<double> tileMax;   // タイルごとの最大水深・水深の変化の最大値
+    vector<double> tileSum;   // タイルごとの貯留量・浸透量 [m]
+    vector<double> tileClamp; // タイルごとの負の水深の補正量 [m]
+    vector<int> tileWet;      // タイルごとの水のあるセルの数
+
+    double hmax = 0.0;                         // 最大水深
+    double clamp = 0.0;                        // 負の水深の補正量 [m]
+    double edgeVolume[4] = { 0.0, 0.0, 0.0, 0.0 }; // 外周からの流出量 [m^3]
+};
+
+struct DomainDecomposition {
+    int width = 0;
+    int height = 0;
+    vector<Subdomain> parts;
+
+    double alpha = 0.7; // CFL係数
+    double hmin = 1e-6; // これ未満の水深は流さない
+    int substeps = 0;   // 直前のステップの分割数
+    bool loaded = false; // 小領域に水深などを写したか（写した後は小領域の方が新しい）
+};
+
+// 小領域の作成（行 y0..y1-1, 呼んだスレッドが配列を確保して初期化する）
+// threads: 小領域を計算するスレッドの数（0 なら使えるスレッドすべて）
+Subdomain makeSubdomain(const vector<vector<double>>& dem, int width, int height, int y0, int y1, int threads = 0);
+
+// 領域分割の作成（parts 個の帯に分ける, 各小領域の配列は受け持つグループが確保して初期化する）
+DomainDecomposition makeDecomposition(const vector<vector<double>>& dem, int width, int height, int parts);
+
+// 全体の配列から小領域に写す（水深・フラグ・浸透の受け持つ行, flags と infil は nullptr なら写さない）
+void loadSubdomain(Subdomain& s, int width, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil);
+
+// 小領域から全体の配列に書き戻す
+void storeSubdomain(const Subdomain& s, int width, vector<vector<double>>& water, CellFlags* flags, InfiltrationState* infil);
+
+// 全部の小領域に写す・書き戻す（小領域ごとに受け持つグループで写す）
+void loadDecomposition(DomainDecomposition& dd, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil);
+void storeDecomposition(const DomainDecomposition& dd, vector<vector<double>>& water, CellFlags* flags, InfiltrationState* infil);
+
+// 時刻 time から DT 秒間の流入を小領域の水深に加える（受け持つ行にないセルは飛ばす, 戻り値は流入量の合計 [m^3]）
+double applySubdomainInflows(vector<InflowSource>& sources, Subdomain* parts, int count, int width, double time, double DT);
+
+// 領域分割で DT 秒進める（simulateLocalInertial と同じ計算, 1次元の河道 opts.channel には未対応）
+// 最初のステップで water, opts.flags, opts.infil を小領域に写し、その後は小領域の中だけで計算する（water は書き換えない）
+void simulateDecomposed(vector<vector<double>>& water, DomainDecomposition& dd, double DT, double n = 0.03, const FlowOptions& opts = FlowOptions());
+
+// 小領域の計算（simulateDecomposed と distributed.h で使う, 中は s.threads 個のスレッドでタイルに分ける）
+// 面と水深の更新は inertial.h の1行分のカーネルを simulateLocalInertial と共有する
+// ステップ開始時の水深を控える（戻り値は貯留量 [m], wet に水のあるセルの数, s.hmax に最大水深）
+double subdomainBegin(Subdomain& s, int width, double hmin, int& wet);
+// 分割した時間刻み1回分:
+// 内部の面（x方向の面と y方向の面 1..rows-1, ハローは使わない）
+void subdomainInteriorFaces(Subdomain& s, int width, double n2, double dt, double hmin);
+// y方向の面 k0..k1（面 0 と面 rows は境目の面で、ハローの水深を使う）
+void subdomainYFaces(Subdomain& s, int width, int k0, int k1, double n2, double dt, double hmin);
+// 外周の面（north, south: グリッドの北端・南端を受け持つか）と水深の更新（戻り値は浸透量の合計 [m]）
+double subdomainUpdate(Subdomain& s, int width, bool north, bool south, double dt, double DT, double n, double hmin, bool last, const FlowOptions& opts);
+// ステップ開始時の水深との差の最大値
+double subdomainMaxChange(Subdomain& s, int width);
+
+#endif // DECOMP_H
@@ -0,0 +1,315 @@
+﻿#include "depression.h"
+#include "simulate.h"
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+static const uint32_t NO_CELL = 0xFFFFFFFFu;
+
+struct FloodCell {
+    double z;
+    uint32_t i;
+    bool operator>(const FloodCell& o) const { return (z > o.z) || (z == o.z && i > o.i); }
+};
+
+// 標高の区間ごとのバケツに分けた優先度付きキュー
+// 取り出し中のバケツだけをヒープにし、それより上のバケツには末尾に追加するだけにする
+// （ヒープが小さく、連続した配列を順に使うので大きなグリッドでもキャッシュに乗りやすい）
+class BucketQueue {
+public:
+    BucketQueue(double zmin, double zmax, size_t maxBuckets = 65536) : zmin(zmin) {
+        double range = max(zmax - zmin, 1e-9);
+        double res = max(range / (double)(maxBuckets - 1), 1e-3); // 1mm より細かくは分けない
+        inv = 1.0 / res;
+        buckets.resize((size_t)(range * inv) + 1);
+    }
+
+    bool empty() const { return count == 0; }
+
+    void push(double z, uint32_t i) {
+        size_t b = bucketOf(z);
+        if (b < cur) b = cur; // 掘り下げで下がったセルは今のバケツに入れる
+        vector<FloodCell>& v = buckets[b];
+        v.push_back({ z, i });
+        if (b == cur && heaped) push_heap(v.begin(), v.end(), greater<FloodCell>());
+        ++count;
+    }
+
+    FloodCell pop() {
+        while (buckets[cur].empty()) {
+            vector<FloodCell>().swap(buckets[cur]); // 使い終わったバケツのメモリを返す
+            ++cur;
+            heaped = false;
+        }
+        vector<FloodCell>& v = buckets[cur];
+        if (!heaped) {
+            make_heap(v.begin(), v.end(), greater<FloodCell>());
+            heaped = true;
+        }
+        pop_heap(v.begin(), v.end(), greater<FloodCell>());
+        FloodCell c = v.back();
+        v.pop_back();
+        --count;
+        return c;
+    }
+
+private:
+    size_t bucketOf(double z) const {
+        double b = (z - zmin) * inv;
+        if (b <= 0.0) return 0;
+        size_t k = (size_t)b;
+        return (k < buckets.size()) ? k : buckets.size() - 1;
+    }
+
+    vector<vector<FloodCell>> buckets;
+    double zmin;
+    double inv = 1.0;
+    size_t cur = 0;
+    size_t count = 0;
+    bool heaped = false;
+};
+
+// 窪地の除去
+DepressionStats fillDepressions(vector<vector<double>>& dem, int width, int height, const DepressionOptions& opt) {
+    DepressionStats st;
+    if (opt.method == DepressionMethod::None || width <= 0 || height <= 0) return st;
+
+    const size_t cells = (size_t)width * height;
+    const double eps = (opt.method == DepressionMethod::Fill) ? 0.0 : opt.epsilon;
+    const bool breach = (opt.method == DepressionMethod::Breach);
+
+    vector<double> z(cells);
+    vector<double> z0; // 元の標高（体積の集計用）
+    double zmin = dem[0][0], zmax = dem[0][0];
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            double v = dem[y][x];
+            z[(size_t)y * width + x] = v;
+            zmin = min(zmin, v);
+            zmax = max(zmax, v);
+        }
+    }
+    z0 = z;
+
+    vector<unsigned char> closed(cells, 0);
+    vector<uint32_t> from; // 掘り下げ用：どのセルから届いたか（出口側）
+    if (breach) from.assign(cells, NO_CELL);
+
+    BucketQueue open(zmin, zmax);
+    vector<uint32_t> pit; // 埋めた・掘った窪地の中のセル（標高順に並べる必要がないので FIFO）
+    size_t pitHead = 0;
+
+    // 外周のセルが出口
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            if (y != 0 && y != height - 1 && x != 0 && x != width - 1) continue;
+            uint32_t i = (uint32_t)((size_t)y * width + x);
+            closed[i] = 1;
+            open.push(z[i], i);
+        }
+    }
+
+    while (pitHead < pit.size() || !open.empty()) {
+        uint32_t c;
+        if (pitHead < pit.size()) {
+            c = pit[pitHead++];
+            if (pitHead == pit.size()) {
+                pit.clear();
+                pitHead = 0;
+            }
+        }
+        else {
+            c = open.pop().i;
+        }
+
+        int cy = (int)(c / width);
+        int cx = (int)(c % width);
+        for (int d = 0; d < 8; ++d) {
+            int nx = cx + dxc[d];
+            int ny = cy + dyc[d];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+            uint32_t n = (uint32_t)((size_t)ny * width + nx);
+            if (closed[n]) continue;
+            closed[n] = 1;
+            if (breach) from[n] = c;
+
+            if (z[n] > z[c]) {
+                open.push(z[n], n);
+                continue;
+            }
+
+            // n は出口へ下れない：掘り下げられるか確かめる
+            bool carved = false;
+            if (breach) {
+                double prev = z[n];
+                bool ok = true;
+                for (uint32_t k = c; k != NO_CELL && z[k] >= prev; k = from[k]) {
+                    prev -= eps;
+                    if (z0[k] - prev > opt.maxBreachDepth) {
+                        ok = false;
+                        break;
+                    }
+                }
+                if (ok) {
+                    prev = z[n];
+                    for (uint32_t k = c; k != NO_CELL && z[k] >= prev; k = from[k]) {
+                        prev -= eps;
+                        z[k] = prev;
+                    }
+                    carved = true;
+                }
+            }
+            if (!carved) {
+                z[n] = (eps > 0.0) ? z[c] + eps : z[c];
+            }
+            pit.push_back(n);
+        }
+    }
+
+    // 書き戻しと集計
+    const double area = w * w;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t)y * width + x;
+            double dz = z[i] - z0[i];
+            if (dz > 0.0) {
+                ++st.raised;
+                st.fillVolume += dz * area;
+            }
+            else if (dz < 0.0) {
+                ++st.carved;
+                st.cutVolume -= dz * area;
+            }
+            dem[y][x] = z[i];
+        }
+    }
+    return st;
+}
+
+// 平坦地の流向
+// 1. 流向のあるセルのうち、同じ標高の平坦地に接するものを低い縁、平坦地のうち高いセルに接するものを高い縁とする
+// 2. 低い縁から同じ標高のセルをたどって平坦地に番号を付ける（番号のない高い縁は出口のない平坦地）
+// 3. 高い縁からの距離 away と低い縁からの距離 toward を幅優先探索で求める
+// 4. 2 * toward + (平坦地内の away の最大 - away) が小さい隣へ流す（低い縁に近いほど、高い縁から遠いほど小さい）
+size_t resolveFlats(const vector<vector<double>>& dem, vector<vector<int>>& flowDir, int width, int height) {
+    const size_t cells = (size_t)width * height;
+    vector<double> z(cells);
+    vector<unsigned char> drains(cells); // 流向がある（外周のセルは領域外へ流れ出る）
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t)y * width + x;
+            z[i] = dem[y][x];
+            bool border = (y == 0 || y == height - 1 || x == 0 || x == width - 1);
+            drains[i] = (flowDir[y][x] != 0 || border) ? 1 : 0;
+        }
+    }
+
+    auto neighbor = [&](uint32_t i, int d) -> uint32_t {
+        int nx = (int)(i % width) + dxc[d];
+        int ny = (int)(i / width) + dyc[d];
+        if (nx < 0 || nx >= width || ny < 0 || ny >= height) return NO_CELL;
+        return (uint32_t)((size_t)ny * width + nx);
+    };
+
+    // 1. 縁を探す
+    vector<uint32_t> lowEdges, highEdges;
+    for (uint32_t i = 0; i < (uint32_t)cells; ++i) {
+        bool low = false, high = false;
+        for (int d = 0; d < 8; ++d) {
+            uint32_t n = neighbor(i, d);
+            if (n == NO_CELL) continue;
+            if (drains[i] && !drains[n] && z[n] == z[i]) low = true;
+            if (!drains[i] && z[n] > z[i]) high = true;
+        }
+        if (low) lowEdges.push_back(i);
+        else if (high) highEdges.push_back(i);
+    }
+    if (lowEdges.empty()) return 0;
+
+    // 2. 平坦地の番号
+    vector<uint32_t> label(cells, 0);
+    uint32_t labels = 0;
+    vector<uint32_t> stack;
+    for (uint32_t e : lowEdges) {
+        if (label[e]) continue;
+        ++labels;
+        stack.push_back(e);
+        label[e] = labels;
+        while (!stack.empty()) {
+            uint32_t i = stack.back();
+            stack.pop_back();
+            for (int d = 0; d < 8; ++d) {
+                uint32_t n = neighbor(i, d);
+                if (n == NO_CELL || label[n] || z[n] != z[i]) continue;
+                if (drains[n] && drains[i]) continue; // 流向のあるセル同士はたどらない
+                label[n] = labels;
+                stack.push_back(n);
+            }
+        }
+    }
+
+    // 3. 高い縁からの距離
+    vector<uint32_t> away(cells, 0);
+    vector<uint32_t> flatHeight(labels + 1, 0);
+    vector<uint32_t> ring, next;
+    for (uint32_t e : highEdges) {
+        if (!label[e]) continue; // 出口のない平坦地
+        away[e] = 1;
+        ring.push_back(e);
+    }
+    for (uint32_t dist = 1; !ring.empty(); ++dist) {
+        next.clear();
+        for (uint32_t i : ring) {
+            flatHeight[label[i]] = max(flatHeight[label[i]], dist);
+            for (int d = 0; d < 8; ++d) {
+                uint32_t n = neighbor(i, d);
+                if (n == NO_CELL || away[n] || drains[n] || label[n] != label[i]) continue;
+                away[n] = dist + 1;
+                next.push_back(n);
+            }
+        }
+        ring.swap(next);
+    }
+
+    // 低い縁からの距離と合わせた勾配
+    vector<uint32_t> mask(cells, 0);
+    vector<unsigned char> seen(cells, 0);
+    ring.assign(lowEdges.begin(), lowEdges.end());
+    for (uint32_t e : lowEdges) seen[e] = 1;
+    for (uint32_t dist = 1; !ring.empty(); ++dist) {
+        next.clear();
+        for (uint32_t i : ring) {
+            for (int d = 0; d < 8; ++d) {
+                uint32_t n = neighbor(i, d);
+                if (n == NO_CELL || seen[n] || drains[n] || label[n] != label[i]) continue;
+                seen[n] = 1;
+                uint32_t up = away[n] ? flatHeight[label[n]] - away[n] : 0;
+                mask[n] = 2 * dist + up;
+                next.push_back(n);
+            }
+        }
+        ring.swap(next);
+    }
+
+    // 4. 流向を決める（低い縁は 0 として扱う）
+    size_t resolved = 0;
+    for (uint32_t i = 0; i < (uint32_t)cells; ++i) {
+        if (drains[i] || !seen[i]) continue;
+        uint32_t best = mask[i];
+        int bestDir = -1;
+        for (int d = 0; d < 8; ++d) {
+            uint32_t n = neighbor(i, d);
+            if (n == NO_CELL || label[n] != label[i] || !seen[n]) continue;
+            uint32_t m = drains[n] ? 0 : mask[n];
+            if (m < best) {
+                best = m;
+                bestDir = d;
+            }
+        }
+        if (bestDir >= 0) {
+            flowDir[i / width][i % width] = dirCode[bestDir];
+            ++resolved;
+        }
+    }
+    return resolved;
+}
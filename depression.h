@@ -0,0 +1,40 @@
+﻿#ifndef DEPRESSION_H
+#define DEPRESSION_H
+
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+// 窪地の処理方法
+enum class DepressionMethod {
+    None,    // 何もしない
+    Fill,    // 流出点の高さまで水平に埋める（平坦地は resolveFlats で流向を決める）
+    Epsilon, // 埋めたうえで epsilon ずつ傾ける
+    Breach   // 流出点までの経路を掘り下げる（深すぎる場合は埋める）
+};
+
+struct DepressionOptions {
+    DepressionMethod method = DepressionMethod::Epsilon;
+    double epsilon = 1e-4;        // 傾ける・掘り下げるときの1セルあたりの高低差 [m]
+    double maxBreachDepth = 5.0;  // 掘り下げの上限 [m]（これを超える窪地は埋める）
+};
+
+struct DepressionStats {
+    size_t raised = 0;       // 埋めたセル数
+    size_t carved = 0;       // 掘り下げたセル数
+    double fillVolume = 0.0; // 埋めた体積 [m^3]
+    double cutVolume = 0.0;  // 掘り下げた体積 [m^3]
+};
+
+// 窪地の除去（Priority-Flood, Barnes et al. 2014）
+// 外周のセルを出口として低い順に広げ、出口へ下れないセルを埋めるか経路を掘り下げる
+// 優先度付きキューは標高の区間ごとのバケツに分け、処理中のバケツだけをヒープにする
+DepressionStats fillDepressions(vector<vector<double>>& dem, int width, int height, const DepressionOptions& opt = DepressionOptions());
+
+// 平坦地の流向（Barnes et al. 2014）
+// 流向が 0 の平坦地について、高い側から離れ低い側（出口）へ向かう勾配を作って流向を決める
+// 出口のない平坦地はそのまま。戻り値は流向を決めたセル数
+size_t resolveFlats(const vector<vector<double>>& dem, vector<vector<int>>& flowDir, int width, int height);
+
+#endif // DEPRESSION_H
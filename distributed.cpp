@@ -0,0 +1,192 @@
+﻿#include "distributed.h"
+#include "inertial.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "inflow.h"
+#include "massbalance.h"
+#include "cellflags.h"
+#include <cmath>
+#include <algorithm>
+#ifdef RIVER_SIM_USE_MPI
+#include <mpi.h>
+#endif
+
+static const double g = 9.81; // 重力加速度 [m/s^2]
+
+
+// MPI の初期化
+void initDistributed(int* argc, char*** argv, int& rank, int& ranks) {
+#ifdef RIVER_SIM_USE_MPI
+    MPI_Init(argc, argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+#else
+    (void)argc;
+    (void)argv;
+    rank = 0;
+    ranks = 1;
+#endif
+}
+
+void finalizeDistributed() {
+#ifdef RIVER_SIM_USE_MPI
+    MPI_Finalize();
+#endif
+}
+
+// 自分の帯の作成
+DistributedDomain makeDistributed(const vector<vector<double>>& dem, int width, int height, int rank, int ranks) {
+    DistributedDomain dd;
+    dd.rank = rank;
+    dd.ranks = ranks;
+    dd.width = width;
+    dd.height = height;
+    dd.rowStart.resize(ranks + 1);
+    for (int r = 0; r <= ranks; ++r) dd.rowStart[r] = (int)((long long)height * r / ranks);
+    dd.local = makeSubdomain(dem, width, height, dd.rowStart[rank], dd.rowStart[rank + 1]);
+    return dd;
+}
+
+// 自分の帯に写す
+void loadDistributed(DistributedDomain& dd, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil) {
+    loadSubdomain(dd.local, dd.width, water, flags, infil);
+    dd.loaded = true;
+}
+
+// DT 秒進める
+void simulateDistributed(vector<vector<double>>& water, DistributedDomain& dd, double DT, double n, const FlowOptions& opts) {
+    const int W = dd.width;
+    const int H = dd.height;
+    Subdomain& s = dd.local;
+    const int rows = s.rows();
+    const bool north = (dd.rank == 0);             // グリッドの北端を受け持つ
+    const bool south = (dd.rank == dd.ranks - 1);  // グリッドの南端を受け持つ
+    const double n2 = n * n;
+
+    if (!dd.loaded) loadDistributed(dd, water, opts.flags, opts.infil);
+
+    // ステップ開始時の水深を控える
+    int wet = 0;
+    double storage = subdomainBegin(s, W, dd.hmin, wet);
+    double hmax = s.hmax;
+
+    // CFL条件から分割数を決める（全ランクの最大水深で決めるので、どのランクも同じ時間刻み）
+#ifdef RIVER_SIM_USE_MPI
+    double localMax = hmax;
+    MPI_Allreduce(&localMax, &hmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+    double dtMax = (hmax > dd.hmin) ? dd.alpha * w / sqrt(g * hmax) : DT;
+    int nsub = max(1, (int)ceil(DT / dtMax));
+    double dt = DT / nsub;
+    dd.substeps = nsub;
+
+    double infil = 0.0;
+    for (int st = 0; st < nsub; ++st) {
+        bool last = (st == nsub - 1);
+
+        // 境目の行の送受信を始める（北へ送るのはタグ 0, 南へ送るのはタグ 1）
+#ifdef RIVER_SIM_USE_MPI
+        MPI_Request req[4];
+        int nreq = 0;
+        double* h = s.h.data();
+        if (!north) {
+            MPI_Irecv(h, W, MPI_DOUBLE, dd.rank - 1, 1, MPI_COMM_WORLD, &req[nreq++]);
+            MPI_Isend(h + W, W, MPI_DOUBLE, dd.rank - 1, 0, MPI_COMM_WORLD, &req[nreq++]);
+        }
+        if (!south) {
+            MPI_Irecv(h + (size_t)(rows + 1) * W, W, MPI_DOUBLE, dd.rank + 1, 0, MPI_COMM_WORLD, &req[nreq++]);
+            MPI_Isend(h + (size_t)rows * W, W, MPI_DOUBLE, dd.rank + 1, 1, MPI_COMM_WORLD, &req[nreq++]);
+        }
+#endif
+
+        // 届くのを待つ間にハローを使わない面を計算する
+        subdomainInteriorFaces(s, W, n2, dt, dd.hmin);
+
+#ifdef RIVER_SIM_USE_MPI
+        MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+#endif
+
+        // 境目の面（グリッドの北端・南端は subdomainUpdate で外周として扱う）
+        if (!north) subdomainYFaces(s, W, 0, 0, n2, dt, dd.hmin);
+        if (!south) subdomainYFaces(s, W, rows, rows, n2, dt, dd.hmin);
+
+        double loss = subdomainUpdate(s, W, north, south, dt, DT, n, dd.hmin, last, opts);
+        if (last) infil = loss;
+    }
+
+    // ステップ開始時の水深との差の最大値
+    double dh = subdomainMaxChange(s, W);
+
+    // 水収支と境界からの流出量を全ランクで足す（水深の変化は最大値）
+    double sums[8] = { storage, infil, s.clamp, s.edgeVolume[0], s.edgeVolume[1], s.edgeVolume[2], s.edgeVolume[3], (double)wet };
+#ifdef RIVER_SIM_USE_MPI
+    double local[8];
+    copy(sums, sums + 8, local);
+    MPI_Allreduce(local, sums, 8, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    double localDh = dh;
+    MPI_Allreduce(&localDh, &dh, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+
+    double boundaryVolume = 0.0;
+    for (int e = 0; e < 4; ++e) {
+        if (opts.bflux) {
+            opts.bflux->step[e] = sums[3 + e];
+            opts.bflux->total[e] += sums[3 + e];
+        }
+        boundaryVolume += sums[3 + e];
+    }
+
+    // 上流からの流入（流量は全ランクで同じ値になり、水は自分の帯にあるセルにだけ足す）
+    double inflowVolume = 0.0;
+    if (opts.inflows) {
+        inflowVolume = applySubdomainInflows(*opts.inflows, &s, 1, W, opts.time, DT);
+    }
+
+    MassLedger* ledger = opts.ledger;
+    if (ledger) {
+        beginLedgerStep(*ledger, 1);
+        ledger->parts[0].storage = sums[0];
+        ledger->parts[0].infil = sums[1];
+        ledger->parts[0].clamp = sums[2];
+        ledger->parts[0].wet = sums[7];
+        ledger->parts[0].dhmax = dh;
+        ledger->parts[0].hmax = hmax; // 全ランクの最大値
+        finishLedgerStep(*ledger, w * w, opts.rainfall * w * w * W * H, inflowVolume, boundaryVolume, 0);
+    }
+}
+
+// 全ランクの帯をランク 0 に集める
+void gatherWater(const DistributedDomain& dd, vector<vector<double>>& water, CellFlags* flags) {
+    if (!dd.loaded) return; // まだ計算していなければ全体の配列の方が新しい
+#ifdef RIVER_SIM_USE_MPI
+    const int W = dd.width;
+    const Subdomain& s = dd.local;
+    const int count = s.rows() * W;
+
+    vector<int> counts, displs;
+    vector<double> recv;
+    if (dd.rank == 0) {
+        counts.resize(dd.ranks);
+        displs.resize(dd.ranks);
+        for (int r = 0; r < dd.ranks; ++r) {
+            counts[r] = (dd.rowStart[r + 1] - dd.rowStart[r]) * W;
+            displs[r] = dd.rowStart[r] * W;
+        }
+        recv.resize((size_t)dd.height * W);
+    }
+    MPI_Gatherv(s.h.data() + W, count, MPI_DOUBLE, recv.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, MPI_COMM_WORLD); // ハローの次の行から
+
+    if (dd.rank == 0) {
+        for (int y = 0; y < dd.height; ++y) {
+            copy(recv.begin() + (size_t)y * W, recv.begin() + (size_t)(y + 1) * W, water[y].begin());
+        }
+    }
+
+    // フラグ（帯が持っていれば）
+    if (flags && !s.flags.empty()) {
+        MPI_Gatherv(s.flags.data(), count, MPI_UNSIGNED_CHAR, dd.rank == 0 ? flags->bits.data() : nullptr, counts.data(), displs.data(), MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+    }
+#else
+    storeSubdomain(dd.local, dd.width, water, flags, nullptr); // 1 ランクなら帯が全体
+#endif
+}
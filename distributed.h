@@ -0,0 +1,52 @@
+﻿#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <vector>
+#include "simulate.h"
+#include "decomp.h"
+
+using namespace std;
+
+// 複数プロセス（MPI）での局所慣性近似
+// RIVER_SIM_USE_MPI を定義してビルドすると MPI を使う（定義しなければ 1 ランクで同じ計算をする）
+// グリッドをランクごとの横長の帯に分け、計算中は自分の帯の水深・フラグ・浸透の状態と面の流量だけを持つ
+// （地形の前処理はどのランクも全体で行うので、そのときのメモリはランク数で減らない
+//   全体の配列は帯に写した後、ランク 0 以外では捨てる）
+// 分割した時間刻みごとに、境目の1行を非同期に送受信しながら内部の面を計算し、届いてから境目の面を計算する
+// 時間刻み（最大水深）と水収支・境界からの流出量はランク全体で集計するので、どのランクでも同じ値になる
+// 1台での確認：mpirun -np 4 ./river_sim
+
+// MPI の初期化（MPI を使わないビルドでは rank = 0, ranks = 1）
+void initDistributed(int* argc, char*** argv, int& rank, int& ranks);
+void finalizeDistributed();
+
+struct DistributedDomain {
+    int rank = 0;
+    int ranks = 1;
+    int width = 0;
+    int height = 0;
+    vector<int> rowStart; // ランク r の帯は行 rowStart[r]..rowStart[r+1]-1
+    Subdomain local;      // 自分の帯（上下に1行ずつハロー）
+
+    double alpha = 0.7; // CFL係数
+    double hmin = 1e-6; // これ未満の水深は流さない
+    int substeps = 0;   // 直前のステップの分割数
+    bool loaded = false; // 自分の帯に水深などを写したか
+};
+
+// 自分の帯の作成（dem は全体, 帯の標高だけ写す）
+DistributedDomain makeDistributed(const vector<vector<double>>& dem, int width, int height, int rank, int ranks);
+
+// 全体の water, flags, infil から自分の帯に写す（この後は全体の配列を使わないので、捨ててよい）
+void loadDistributed(DistributedDomain& dd, const vector<vector<double>>& water, const CellFlags* flags, const InfiltrationState* infil);
+
+// DT 秒進める（自分の帯の中だけで計算する, 1次元の河道 opts.channel には未対応）
+// 帯に写していなければ最初に water, opts.flags, opts.infil から写す
+// 流入点の流量は全ランクが同じように数え、自分の帯にあるセルにだけ足す
+void simulateDistributed(vector<vector<double>>& water, DistributedDomain& dd, double DT, double n = 0.03, const FlowOptions& opts = FlowOptions());
+
+// 全ランクの帯の水深をランク 0 の water に集める（画像の保存の前に全ランクで呼ぶ, ランク 0 の water は全体の大きさ）
+// flags があればフラグもランク 0 に集める
+void gatherWater(const DistributedDomain& dd, vector<vector<double>>& water, CellFlags* flags = nullptr);
+
+#endif // DISTRIBUTED_H
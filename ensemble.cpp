@@ -0,0 +1,242 @@
+﻿#include "ensemble.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "massbalance.h"
+#include "inertial.h"
+#include "inertial_batch.h"
+#include "cellflags.h"
+#include "WaterDepth_image.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// シナリオの読み込み
+vector<Scenario> loadScenarios(const string& filename) {
+    vector<Scenario> scenarios;
+
+    ifstream file(filename);
+    if (!file) {
+        cerr << "シナリオのファイルを開けません: " << filename << endl;
+        return scenarios;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        vector<string> item;
+        istringstream iss(line);
+        string s;
+        while (getline(iss, s, ',')) item.push_back(s);
+        if (item.size() != 6) {
+            cerr << "シナリオの形式が違います: " << line << endl;
+            continue;
+        }
+
+        Scenario sc;
+        sc.name = item[0];
+        sc.n = atof(item[1].c_str());
+        sc.rainfall = atof(item[2].c_str());
+        sc.depth = atof(item[3].c_str());
+        sc.dt = atof(item[4].c_str());
+        sc.steps = atoi(item[5].c_str());
+        if (sc.n <= 0.0 || sc.dt <= 0.0 || sc.steps <= 0) {
+            cerr << "シナリオの値が正しくありません: " << line << endl;
+            continue;
+        }
+        scenarios.push_back(sc);
+    }
+    return scenarios;
+}
+
+// シナリオの結果をまとめる（浸水面積はまとめて計算したときも1つずつのときも最後の水深で数える）
+static ScenarioResult makeResult(const string& name, const vector<vector<double>>& water, const MassLedger& ledger) {
+    ScenarioResult r;
+    r.name = name;
+    size_t wetCells = 0;
+    KahanSum storage;
+    for (const auto& row : water) {
+        for (double h : row) {
+            storage.add(h);
+            r.maxDepth = max(r.maxDepth, h);
+            wetCells += (h > WET_DEPTH);
+        }
+    }
+    r.storage = storage.sum * w * w;
+    r.rainIn = ledger.rainIn;
+    r.infilOut = ledger.infilOut;
+    r.boundaryOut = ledger.boundaryOut;
+    r.error = ledger.error;
+    r.wetArea = wetCells * w * w;
+    return r;
+}
+
+// 1つのシナリオの計算（状態はすべてこの中で持つ）
+static ScenarioResult runScenario(const Scenario& sc, const EnsembleSetup& setup) {
+    auto start = chrono::high_resolution_clock::now();
+    const vector<vector<double>>& dem = *setup.dem;
+    const int W = setup.width;
+    const int H = setup.height;
+
+    vector<vector<double>> water(H, vector<double>(W, sc.depth));
+    CellFlags flags = *setup.flags;
+    InfiltrationState infil;
+    if (setup.infil) infil = *setup.infil;
+    BoundaryFlux bflux;
+    MassLedger ledger;
+    ledger.interval = 0;
+
+    FlowOptions opts;
+    opts.rainfall = sc.rainfall / 1000.0 * (sc.dt / 3600.0); // mm/h → m/step
+    opts.infil = setup.infil ? &infil : nullptr;
+    opts.boundary = setup.boundary;
+    opts.bflux = &bflux;
+    opts.ledger = &ledger;
+    opts.flags = &flags;
+
+    InertialState inertial;
+    MfdWeights mfd;
+    vector<vector<int>> flowDir;
+    if (setup.engine == SolverEngine::LocalInertial) {
+        inertial = makeInertial(dem, W, H);
+    }
+    else if (setup.routing == RoutingMode::MFD) {
+        mfd = makeMfdWeights(W, H, MfdMethod::Freeman);
+        opts.mfd = &mfd;
+    }
+
+    for (int t = 0; t < sc.steps; ++t) {
+        opts.time = t * sc.dt;
+        if (setup.engine == SolverEngine::LocalInertial) {
+            simulateLocalInertial(water, inertial, W, H, sc.dt, sc.n, opts);
+            continue;
+        }
+        vector<vector<double>> surface = TotalHeight(dem, water, W, H);
+        if (opts.mfd) {
+            computeMfdWeights(surface, mfd);
+        }
+        else if (flowDir.empty()) {
+            flowDir = computeFlowDirection(surface, W, H);
+        }
+        else {
+            updateFlowDirection(surface, flowDir, flags, W, H);
+        }
+        simulateWaterFlow(water, flowDir, surface, W, H, sc.dt, sc.n, opts);
+    }
+
+    ScenarioResult r = makeResult(sc.name, water, ledger);
+
+    if (!setup.imageDir.empty()) {
+#pragma omp critical(ensembleOutput)
+        saveWaterDepthAsImage(water, setup.imageDir + "ensemble_" + sc.name + ".png");
+    }
+
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    r.seconds = elapsed.count();
+    return r;
+}
+
+// BATCH_LANES 個までのシナリオ（DT とステップ数が同じ）をまとめて計算する
+static vector<ScenarioResult> runBatch(const vector<Scenario>& scenarios, const vector<int>& members, const EnsembleSetup& setup) {
+    auto start = chrono::high_resolution_clock::now();
+    const int W = setup.width;
+    const int H = setup.height;
+    const Scenario& first = scenarios[members[0]];
+
+    // 余ったレーンは最初のシナリオで埋める（結果は使わない）
+    BatchInertialState st = makeBatchInertial(*setup.dem, W, H);
+    if (setup.infil) st.infil.assign(BATCH_LANES, *setup.infil);
+    for (int k = 0; k < BATCH_LANES; ++k) {
+        const Scenario& sc = scenarios[members[k < (int)members.size() ? k : 0]];
+        st.n[k] = sc.n;
+        st.rainfall[k] = sc.rainfall / 1000.0 * (sc.dt / 3600.0); // mm/h → m/step
+        st.ledger[k].interval = 0;
+        setBatchWater(st, k, vector<vector<double>>(H, vector<double>(W, sc.depth)));
+    }
+
+    for (int t = 0; t < first.steps; ++t) {
+        simulateBatchInertial(st, first.dt, setup.boundary);
+    }
+
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    vector<ScenarioResult> results;
+    for (size_t k = 0; k < members.size(); ++k) {
+        const Scenario& sc = scenarios[members[k]];
+        vector<vector<double>> water;
+        getBatchWater(st, (int)k, water);
+        ScenarioResult r = makeResult(sc.name, water, st.ledger[k]);
+        r.seconds = elapsed.count(); // まとめて計算した時間
+        if (!setup.imageDir.empty()) {
+#pragma omp critical(ensembleOutput)
+            saveWaterDepthAsImage(water, setup.imageDir + "ensemble_" + sc.name + ".png");
+        }
+        results.push_back(r);
+    }
+    return results;
+}
+
+// シナリオ単位（まとめて計算するときはまとめた単位）でスレッドに分けて計算する
+vector<ScenarioResult> runEnsemble(const vector<Scenario>& scenarios, const EnsembleSetup& setup) {
+    vector<ScenarioResult> results(scenarios.size());
+
+    // ステップ数の多いシナリオから始めると最後に1つだけ残りにくい
+    vector<int> order(scenarios.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return scenarios[a].steps > scenarios[b].steps;
+    });
+
+    // 計算の単位（まとめないときは1シナリオずつ, まとめるときは DT とステップ数が同じシナリオを BATCH_LANES 個ずつ）
+    vector<vector<int>> jobs;
+    const bool batch = setup.batch && setup.engine == SolverEngine::LocalInertial;
+    for (int i : order) {
+        bool added = false;
+        if (batch) {
+            for (auto& job : jobs) {
+                const Scenario& a = scenarios[job[0]];
+                if ((int)job.size() < BATCH_LANES && a.dt == scenarios[i].dt && a.steps == scenarios[i].steps) {
+                    job.push_back(i);
+                    added = true;
+                    break;
+                }
+            }
+        }
+        if (!added) jobs.push_back(vector<int>(1, i));
+    }
+    if (batch) cout << "まとめて計算: " << jobs.size() << "組\n";
+
+    int threads = setup.concurrent > 0 ? setup.concurrent : (int)max(1u, thread::hardware_concurrency());
+    threads = max(1, min(threads, (int)jobs.size()));
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+    for (int j = 0; j < (int)jobs.size(); ++j) {
+        vector<ScenarioResult> r;
+        if (jobs[j].size() > 1) r = runBatch(scenarios, jobs[j], setup); // 1つだけのときはまとめない
+        else r.push_back(runScenario(scenarios[jobs[j][0]], setup));
+
+        for (size_t k = 0; k < r.size(); ++k) {
+            int i = jobs[j][k];
+            results[i] = r[k];
+#pragma omp critical(ensembleOutput)
+            cout << "シナリオ " << results[i].name << ": 貯留 " << results[i].storage << "m3, 境界流出 " << results[i].boundaryOut
+                 << "m3, 最大水深 " << results[i].maxDepth << "m (" << results[i].seconds << "秒)\n";
+        }
+    }
+    return results;
+}
+
+void saveEnsembleCsv(const vector<ScenarioResult>& results, const string& filename) {
+    ofstream file(filename);
+    if (!file) {
+        cerr << "ファイルを開けません: " << filename << endl;
+        return;
+    }
+    file << "name,storage,rain,infiltration,boundary_out,error,max_depth,wet_area,seconds\n";
+    for (const ScenarioResult& r : results) {
+        file << r.name << "," << r.storage << "," << r.rainIn << "," << r.infilOut << "," << r.boundaryOut << ","
+             << r.error << "," << r.maxDepth << "," << r.wetArea << "," << r.seconds << "\n";
+    }
+}
@@ -0,0 +1,65 @@
+﻿#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <vector>
+#include <string>
+#include "simulate.h"
+#include "mfd.h"
+
+using namespace std;
+
+// アンサンブル計算（同じ地形で粗度・雨量・初期水深・時間刻みを変えた計算をまとめて行う）
+// 地形の読み込みと前処理（窪地・流向・土壌など）は1回だけ行い、各シナリオはそれを読むだけで共有する
+// シナリオごとに水深・セルのフラグ・浸透の累積などの状態を持ち、シナリオ単位でスレッドに分けて同時に計算する
+// （シナリオの中の計算は1スレッドで行う）
+// 局所慣性近似では、DT とステップ数が同じシナリオを BATCH_LANES 個ずつ1つのカーネルでまとめて計算することもできる（inertial_batch.h）
+// （まとめたシナリオは時間刻みの分割数を揃えるので、1つずつ計算した結果と一致するのは全シナリオの分割数が同じになるときだけ）
+// river_sim --ensemble [シナリオのファイル] [--batch] で実行し、結果は ensemble_result.csv に書く
+
+// シナリオ（1行に「名前,粗度係数,雨量[mm/h],初期水深[m],DT[s],ステップ数」, # で始まる行は読まない）
+struct Scenario {
+    string name;
+    double n = 0.03;        // マニングの粗度係数
+    double rainfall = 0.0;  // 雨量 [mm/h]
+    double depth = 0.05;    // 初期水深 [m]
+    double dt = 0.1;        // 1ステップの秒数
+    int steps = 5000;       // ステップ数
+};
+
+vector<Scenario> loadScenarios(const string& filename);
+
+// 全シナリオで共有するもの（計算中は読むだけ）
+struct EnsembleSetup {
+    const vector<vector<double>>* dem = nullptr;
+    int width = 0;
+    int height = 0;
+    const CellFlags* flags = nullptr;         // セルの種類（シナリオごとに写して使う）
+    const InfiltrationState* infil = nullptr; // 土壌（nullptr なら浸透なし, シナリオごとに写して使う）
+    const BoundaryConfig* boundary = nullptr; // 外周の境界条件
+    SolverEngine engine = SolverEngine::D8;
+    RoutingMode routing = RoutingMode::D8;
+    int concurrent = 0;                       // 同時に計算するシナリオ数（0 ならコア数）
+    bool batch = false;                       // 局所慣性近似のシナリオをまとめて計算する
+    string imageDir = "image/";               // 最後の水深の画像の保存先（空なら保存しない）
+};
+
+const double WET_DEPTH = 1e-6; // 浸水とみなす水深 [m]（CELL_DRY と同じ判定）
+
+// シナリオの結果 [m^3]
+struct ScenarioResult {
+    string name;
+    double storage = 0.0;     // 最後の貯留量
+    double rainIn = 0.0;      // 降雨の累計
+    double infilOut = 0.0;    // 浸透の累計
+    double boundaryOut = 0.0; // 境界からの流出の累計
+    double error = 0.0;       // 水収支の誤差
+    double maxDepth = 0.0;    // 最後の最大水深 [m]
+    double wetArea = 0.0;     // 最後の浸水面積 [m^2]（最後の水深が WET_DEPTH を超えるセル）
+    double seconds = 0.0;     // 計算時間 [s]
+};
+
+vector<ScenarioResult> runEnsemble(const vector<Scenario>& scenarios, const EnsembleSetup& setup);
+
+void saveEnsembleCsv(const vector<ScenarioResult>& results, const string& filename);
+
+#endif // ENSEMBLE_H
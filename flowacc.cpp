@@ -0,0 +1,164 @@
+﻿#include "flowacc.h"
+#include "simulate.h"
+#include "stb_image_write.h"
+#include <cmath>
+#include <iostream>
+
+
+// D8の流向コードから流下先の配列を作る
+vector<uint32_t> flowDownstream(const vector<vector<int>>& flowDir, int width, int height) {
+    vector<uint32_t> down((size_t)width * height, FLOW_NONE);
+
+#pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int code = flowDir[y][x];
+            if (code == 0) continue;
+
+            for (int d = 0; d < 8; ++d) {
+                if (code != dirCode[d]) continue;
+                int nx = x + dxc[d];
+                int ny = y + dyc[d];
+                if (nx >= 0 && nx < width && ny >= 0 && ny < height) {
+                    down[(size_t)y * width + x] = (uint32_t)((size_t)ny * width + nx);
+                }
+                break;
+            }
+        }
+    }
+    return down;
+}
+
+// 流量累積
+// 1. 流下先の配列と、上流から流れ込むセルの数（入次数）を作る
+// 2. 出口から上流へたどって流域ごとの順序を作る（下流 → 上流の順になる）
+// 3. その順序を逆にたどり、上流の値を流下先に足していく
+// 出口の異なる流域は共有するセルがないので、出口ごとに別のスレッドで計算できる
+FlowAccumulation computeFlowAccumulation(const vector<vector<int>>& flowDir, int width, int height, const vector<double>* weights) {
+    FlowAccumulation acc;
+    acc.width = width;
+    acc.height = height;
+    acc.down = flowDownstream(flowDir, width, height);
+
+    const size_t cells = (size_t)width * height;
+    const uint32_t* down = acc.down.data();
+    const bool weighted = (weights != nullptr && weights->size() == cells);
+
+    // 入次数（隣のセルから集めるので競合しない）
+    vector<unsigned char> indeg(cells, 0);
+#pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint32_t i = (uint32_t)((size_t)y * width + x);
+            unsigned char k = 0;
+            for (int d = 0; d < 8; ++d) {
+                int nx = x + dxc[d];
+                int ny = y + dyc[d];
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                if (down[(size_t)ny * width + nx] == i) ++k;
+            }
+            indeg[i] = k;
+        }
+    }
+
+    for (size_t i = 0; i < cells; ++i) {
+        if (down[i] == FLOW_NONE) acc.outlets.push_back((uint32_t)i);
+    }
+
+    acc.count.assign(cells, 0);
+    if (weighted) acc.weighted.assign(cells, 0.0);
+    uint32_t* count = acc.count.data();
+    double* wsum = weighted ? acc.weighted.data() : nullptr;
+    const double* wt = weighted ? weights->data() : nullptr;
+
+    const int nOutlets = (int)acc.outlets.size();
+#pragma omp parallel
+    {
+        vector<uint32_t> order; // 流域のセル（下流 → 上流）
+        vector<uint32_t> stack;
+
+#pragma omp for schedule(dynamic, 16)
+        for (int k = 0; k < nOutlets; ++k) {
+            order.clear();
+            stack.clear();
+            stack.push_back(acc.outlets[k]);
+
+            // 上流へたどる（入次数の数だけ見つかったら探すのをやめる）
+            while (!stack.empty()) {
+                uint32_t i = stack.back();
+                stack.pop_back();
+                order.push_back(i);
+
+                int remain = indeg[i];
+                if (remain == 0) continue;
+                int y = (int)(i / width);
+                int x = (int)(i % width);
+                for (int d = 0; d < 8 && remain > 0; ++d) {
+                    int nx = x + dxc[d];
+                    int ny = y + dyc[d];
+                    if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                    uint32_t j = (uint32_t)((size_t)ny * width + nx);
+                    if (down[j] == i) {
+                        stack.push_back(j);
+                        --remain;
+                    }
+                }
+            }
+
+            // 上流から順に足す（流下先は必ず後で処理される）
+            for (size_t m = order.size(); m-- > 0;) {
+                uint32_t i = order[m];
+                count[i] += 1;
+                if (wsum) wsum[i] += wt[i];
+                uint32_t j = down[i];
+                if (j != FLOW_NONE) {
+                    count[j] += count[i];
+                    if (wsum) wsum[j] += wsum[i];
+                }
+            }
+        }
+    }
+
+    // 出口にたどり着かないセル（流向が循環している場合）は自分だけ数える
+    size_t orphan = 0;
+    for (size_t i = 0; i < cells; ++i) {
+        if (count[i] == 0) {
+            count[i] = 1;
+            if (wsum) wsum[i] = wt[i];
+            ++orphan;
+        }
+    }
+    if (orphan > 0) {
+        cerr << "流向が循環しているセルがあります: " << orphan << "セル\n";
+    }
+
+    return acc;
+}
+
+// 集水面積 [m^2]
+double contributingArea(const FlowAccumulation& acc, int y, int x) {
+    return acc.count[(size_t)y * acc.width + x] * w * w;
+}
+
+// 累積セル数の画像（対数でグレースケール）
+void saveFlowAccumulationImage(const FlowAccumulation& acc, const char* filename) {
+    const size_t cells = acc.count.size();
+    uint32_t maxCount = 1;
+    for (size_t i = 0; i < cells; ++i) {
+        if (acc.count[i] > maxCount) maxCount = acc.count[i];
+    }
+    cout << "最大累積セル数:" << maxCount << "（" << maxCount * w * w / 1e6 << "km^2）\n";
+
+    double scale = (maxCount > 1) ? 255.0 / log((double)maxCount) : 0.0;
+    vector<unsigned char> image(cells);
+    for (size_t i = 0; i < cells; ++i) {
+        image[i] = static_cast<unsigned char>(log((double)acc.count[i]) * scale);
+    }
+
+    if (stbi_write_png(filename, acc.width, acc.height, 1, image.data(), acc.width)) {
+        cout << "流量累積画像保存成功: " << filename << "\n\n";
+    }
+    else {
+        cerr << "流量累積画像保存失敗: " << filename << "\n\n";
+    }
+}
@@ -0,0 +1,35 @@
+﻿#ifndef FLOWACC_H
+#define FLOWACC_H
+
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+const uint32_t FLOW_NONE = 0xFFFFFFFFu; // 流下先なし（窪地・領域外へ流出）
+
+// 流量累積の結果（セルの値は y * width + x）
+struct FlowAccumulation {
+    int width = 0;
+    int height = 0;
+    vector<uint32_t> down;      // 流下先のセル
+    vector<uint32_t> count;     // 自分を含む上流のセル数
+    vector<double> weighted;    // 重み付きの累積（重みを渡したときだけ）
+    vector<uint32_t> outlets;   // 流域の出口（down が FLOW_NONE のセル）
+};
+
+// D8の流向コード（computeFlowDirection の結果）から流下先の配列を作る
+vector<uint32_t> flowDownstream(const vector<vector<int>>& flowDir, int width, int height);
+
+// 流量累積（O(N)）
+// 出口ごとの流域は互いに独立なので、流域単位でスレッドに分けて計算する
+// weights: セルごとの重み（降雨量など, nullptr なら weighted は作らない）
+FlowAccumulation computeFlowAccumulation(const vector<vector<int>>& flowDir, int width, int height, const vector<double>* weights = nullptr);
+
+// 集水面積 [m^2]
+double contributingArea(const FlowAccumulation& acc, int y, int x);
+
+// 累積セル数の画像（対数でグレースケール）
+void saveFlowAccumulationImage(const FlowAccumulation& acc, const char* filename);
+
+#endif // FLOWACC_H
@@ -0,0 +1,138 @@
+﻿#ifndef GRID2D_H
+#define GRID2D_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "tiling.h"
+
+using namespace std;
+
+// グリッドのメモリ上の並べ方
+// 行優先では 3x3 の近傍の南北のセルが1行分離れるので、ブロックや Z 順に並べると近傍が同じキャッシュラインに入りやすい
+// どれも index(x, y) で配列の位置を返し、TILE x TILE の揃ったタイルがメモリ上で連続する（行優先は TILE = 0）
+
+// 2のべき乗 v の log2
+constexpr int log2Pow2(int v) { return (v <= 1) ? 0 : 1 + log2Pow2(v >> 1); }
+
+// 行優先（y * width + x, 今までの配列と同じ）
+struct RowMajorLayout {
+    static const int TILE = 0;
+    int width = 0;
+    int height = 0;
+
+    void init(int w, int h) { width = w; height = h; }
+    size_t size() const { return (size_t)width * height; }
+    size_t index(int x, int y) const { return (size_t)y * width + x; }
+};
+
+// B x B のブロックを行優先に並べ、ブロックの中も行優先（B は2のべき乗, 端のブロックは余白を持つ）
+template <int B>
+struct BlockedLayout {
+    static_assert(B > 0 && (B & (B - 1)) == 0, "ブロックの大きさは2のべき乗");
+    static const int TILE = B;
+    static const int SHIFT = log2Pow2(B);
+    static_assert((1 << SHIFT) == B, "SHIFT は log2(B)");
+    int width = 0;
+    int height = 0;
+    int blocksX = 0;
+    int blocksY = 0;
+
+    void init(int w, int h) {
+        width = w;
+        height = h;
+        blocksX = (w + B - 1) / B;
+        blocksY = (h + B - 1) / B;
+    }
+    size_t size() const { return (size_t)blocksX * blocksY * B * B; }
+    size_t index(int x, int y) const {
+        size_t block = (size_t)(y >> SHIFT) * blocksX + (x >> SHIFT);
+        return (block << (2 * SHIFT)) + ((size_t)(y & (B - 1)) << SHIFT) + (x & (B - 1));
+    }
+};
+
+// Z 順（Morton 順, x と y のビットを交互に並べる）
+// 一辺を2のべき乗の正方形に広げるので、細長いグリッドでは余白が大きくなる
+struct MortonLayout {
+    static const int TILE = 32; // 揃った 32 x 32 のタイルは連続する
+    int width = 0;
+    int height = 0;
+    int side = 1;
+
+    // 下位16ビットを1ビットおきに広げる
+    static uint32_t spread(uint32_t v) {
+        v &= 0x0000FFFFu;
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    }
+
+    void init(int w, int h) {
+        width = w;
+        height = h;
+        side = 1;
+        while (side < w || side < h) side *= 2;
+    }
+    size_t size() const { return (size_t)side * side; }
+    size_t index(int x, int y) const { return (size_t)spread((uint32_t)x) | ((size_t)spread((uint32_t)y) << 1); }
+};
+
+// 2次元グリッド（並べ方は L で決める）
+// 今のところ使うのはベンチマーク（bench_layout.cpp）だけで、計算本体の配列は行優先の vector のまま
+template <class T, class L = RowMajorLayout>
+class Grid2D {
+public:
+    typedef L Layout;
+
+    Grid2D() {}
+    Grid2D(int width, int height, T value = T()) {
+        layout_.init(width, height);
+        data_.assign(layout_.size(), value);
+    }
+
+    int width() const { return layout_.width; }
+    int height() const { return layout_.height; }
+    const L& layout() const { return layout_; }
+
+    T& operator()(int x, int y) { return data_[layout_.index(x, y)]; }
+    const T& operator()(int x, int y) const { return data_[layout_.index(x, y)]; }
+
+    T* data() { return data_.data(); }
+    const T* data() const { return data_.data(); }
+
+    // 並べ方に合わせたタイル分割（揃ったタイルはメモリ上で連続, 行優先は makeTileGrid で決める）
+    TileGrid tiles(size_t bytesPerCell = sizeof(T)) const {
+        if (L::TILE == 0) return makeTileGrid(width(), height(), bytesPerCell);
+        TileGrid g;
+        g.width = width();
+        g.height = height();
+        g.tileRows = L::TILE;
+        g.tileCols = L::TILE;
+        g.tilesX = (width() + L::TILE - 1) / L::TILE;
+        g.tilesY = (height() + L::TILE - 1) / L::TILE;
+        return g;
+    }
+
+    // vector<vector<T>> との変換
+    static Grid2D fromRows(const vector<vector<T>>& rows, int width, int height) {
+        Grid2D g(width, height);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) g(x, y) = rows[y][x];
+        }
+        return g;
+    }
+    void toRows(vector<vector<T>>& rows) const {
+        rows.assign(height(), vector<T>(width()));
+        for (int y = 0; y < height(); ++y) {
+            for (int x = 0; x < width(); ++x) rows[y][x] = (*this)(x, y);
+        }
+    }
+
+private:
+    L layout_;
+    vector<T> data_;
+};
+
+#endif // GRID2D_H
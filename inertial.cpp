@@ -0,0 +1,253 @@
+﻿#include "inertial.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "inflow.h"
+#include "massbalance.h"
+#include "channel.h"
+#include "cellflags.h"
+#include <cmath>
+#include <algorithm>
+
+static const double g = 9.81; // 重力加速度 [m/s^2]
+
+
+// 外周の面の外向き流量 [m^2/s]
+// qOut: 前回の外向き流量, h, z: 外周セルの水深と標高, zInner: 1つ内側のセルの標高
+double edgeFaceFlux(const EdgeBoundary& b, double qOut, double h, double z, double zInner, double n, double dt, double hmin) {
+    switch (b.type) {
+    case BoundaryType::FreeOutflow: {
+        if (h <= hmin) return 0.0;
+        double S = (zInner - z) / w;
+        if (S < b.minSlope) S = b.minSlope;
+        double q = pow(h, 5.0 / 3.0) * sqrt(S) / n;
+        double qc = h * sqrt(g * h);
+        return min(q, qc);
+    }
+    case BoundaryType::CriticalDepth: {
+        if (h <= hmin) return 0.0;
+        double hc = h * 2.0 / 3.0;
+        return sqrt(g * hc * hc * hc);
+    }
+    case BoundaryType::FixedStage:
+        // 外側に水位 stage・標高 z のセルがあるとみなす
+        return inertialFlux(qOut, z + h, b.stage, z, z, n * n, dt, hmin);
+    default:
+        return 0.0;
+    }
+}
+
+// 外周の面1つを境界条件で更新する
+double updateEdgeFace(const EdgeBoundary& b, double& q, double sign, double h, double z, double zInner, double n, double dt, double hmin) {
+    double qOut = edgeFaceFlux(b, sign * q, h, z, zInner, n, dt, hmin);
+    if (qOut > 0.0) qOut = min(qOut, h * w / dt); // セルの水より多くは出さない
+    q = sign * qOut;
+    return qOut * w * dt;
+}
+
+// 河道セルの面を制限する（河道の中は1次元で流し、氾濫原へは spillOverbank であふれさせる）
+// 河道セルどうしの面は閉じ、氾濫原との面は河道へ流れ込む向きだけ残す（D8 と同じ）
+static void closeChannelFaces(const ChannelState& ch, double* qx, double* qy) {
+    const int W = ch.width;
+    const int H = ch.height;
+    for (uint32_t c : ch.cells) {
+        int y = (int)(c / W);
+        int x = (int)(c % W);
+        if (x > 0) { // 西（正が流入）
+            double& q = qx[(size_t)y * (W + 1) + x];
+            q = ch.flags->has(c - 1, CELL_CHANNEL) ? 0.0 : max(q, 0.0);
+        }
+        if (x + 1 < W) { // 東（負が流入）
+            double& q = qx[(size_t)y * (W + 1) + x + 1];
+            q = ch.flags->has(c + 1, CELL_CHANNEL) ? 0.0 : min(q, 0.0);
+        }
+        if (y > 0) { // 北（正が流入）
+            double& q = qy[(size_t)y * W + x];
+            q = ch.flags->has(c - W, CELL_CHANNEL) ? 0.0 : max(q, 0.0);
+        }
+        if (y + 1 < H) { // 南（負が流入）
+            double& q = qy[(size_t)(y + 1) * W + x];
+            q = ch.flags->has(c + W, CELL_CHANNEL) ? 0.0 : min(q, 0.0);
+        }
+    }
+}
+
+// 状態の作成
+InertialState makeInertial(const vector<vector<double>>& dem, int width, int height) {
+    InertialState st;
+    st.width = width;
+    st.height = height;
+
+    size_t cells = (size_t)width * height;
+    st.z.resize(cells);
+    st.h.assign(cells, 0.0);
+    st.qx.assign((size_t)(width + 1) * height, 0.0);
+    st.qy.assign((size_t)width * (height + 1), 0.0);
+    st.tiles = makeTileGrid(width, height, 4 * sizeof(double)); // z, h, qx, qy
+    st.tileMax.assign(st.tiles.count(), 0.0);
+    st.tileClamp.assign(st.tiles.count(), 0.0);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            st.z[(size_t)y * width + x] = dem[y][x];
+        }
+    }
+    return st;
+}
+
+// 局所慣性近似で DT 秒進める
+void simulateLocalInertial(vector<vector<double>>& water, InertialState& st, int width, int height, double DT, double n, const FlowOptions& opts) {
+    const int W = width;
+    const int H = height;
+    const double n2 = n * n;
+    const double hmin = st.hmin;
+    const double* z = st.z.data();
+    double* h = st.h.data();
+    double* qx = st.qx.data();
+    double* qy = st.qy.data();
+
+    const double rain = opts.rainfall;
+    InfiltrationState* infil = opts.infil;
+    const bool source = (rain > 0.0 || infil != nullptr);
+
+    const TileGrid& tiles = st.tiles;
+    MassLedger* ledger = opts.ledger;
+    if (ledger) beginLedgerStep(*ledger, tiles.count());
+
+    ChannelState* ch = opts.channel; // 河道セルは岸を超えた分だけで時間刻みを決める
+
+    // 水深を取り込む（水収支の貯留量と最大水深もここで求める）
+    forEachTile(tiles, [&](const Tile& t) {
+        KahanSum storage;
+        double m = 0.0;
+        double peak = 0.0; // 河道セルも含めた最大水深
+        int wet = 0;
+        for (int y = t.y0; y < t.y1; ++y) {
+            double* hr = h + (size_t)y * W;
+            for (int x = t.x0; x < t.x1; ++x) {
+                hr[x] = water[y][x];
+                storage.add(hr[x]);
+                m = max(m, ch ? overbankDepth(*ch, (size_t)y * W + x, hr[x]) : hr[x]);
+                peak = max(peak, hr[x]);
+            }
+            if (opts.flags) wet += updateDryRow(&opts.flags->bits[(size_t)y * W + t.x0], hr + t.x0, t.x1 - t.x0, hmin);
+        }
+        st.tileMax[t.index] = m;
+        st.tileClamp[t.index] = 0.0;
+        if (ledger) {
+            ledger->parts[t.index].storage = storage.sum;
+            ledger->parts[t.index].wet = wet;
+            ledger->parts[t.index].hmax = peak;
+        }
+    });
+    double hmax = *max_element(st.tileMax.begin(), st.tileMax.end());
+
+    // CFL条件から分割数を決める
+    double dtMax = (hmax > hmin) ? st.alpha * w / sqrt(g * hmax) : DT;
+    int nsub = max(1, (int)ceil(DT / dtMax));
+    double dt = DT / nsub;
+    st.substeps = nsub;
+
+    double edgeVolume[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+    for (int s = 0; s < nsub; ++s) {
+        bool last = (s == nsub - 1);
+
+        // 内部の面（タイルの各行で x方向の面と北側の y方向の面を続けて更新し、読んだ行をキャッシュにあるうちに使い回す）
+        // タイルが受け持つのはセルの西側と北側の面なので、タイルどうしで同じ面に書き込まない
+        forEachTile(tiles, [&](const Tile& t) {
+            const int xa = max(t.x0, 1);
+            for (int y = t.y0; y < t.y1; ++y) {
+                const double* z1 = z + (size_t)y * W;
+                const double* h1 = h + (size_t)y * W;
+                inertialXFaceRow(qx + (size_t)y * (W + 1), z1, h1, xa, t.x1, n2, dt, hmin);
+                if (y > 0) inertialYFaceRow(qy + (size_t)y * W, z1 - W, h1 - W, z1, h1, t.x0, t.x1, n2, dt, hmin);
+            }
+        });
+
+        if (ch) closeChannelFaces(*ch, qx, qy);
+
+        // 外周の面（閉境界なら 0 のまま）
+        if (opts.boundary) {
+            for (int e = 0; e < 4; ++e) {
+                const EdgeBoundary& b = opts.boundary->edge[e];
+                if (b.type == BoundaryType::Closed) continue;
+
+                bool horizontal = (e == EDGE_NORTH || e == EDGE_SOUTH);
+                int count = horizontal ? W : H;
+                for (int i = 0; i < count; ++i) {
+                    size_t cell, inner;
+                    double* q;
+                    double sign; // 外向きの符号
+                    if (e == EDGE_NORTH) { cell = i; inner = (size_t)W + i; q = &qy[i]; sign = -1.0; }
+                    else if (e == EDGE_SOUTH) { cell = (size_t)(H - 1) * W + i; inner = cell - W; q = &qy[(size_t)H * W + i]; sign = 1.0; }
+                    else if (e == EDGE_WEST) { cell = (size_t)i * W; inner = cell + 1; q = &qx[(size_t)i * (W + 1)]; sign = -1.0; }
+                    else { cell = (size_t)i * W + W - 1; inner = cell - 1; q = &qx[(size_t)i * (W + 1) + W]; sign = 1.0; }
+
+                    if (ch && ch->flags->has(cell, CELL_CHANNEL)) { // 河道から領域外へは channelStep で流す
+                        *q = 0.0;
+                        continue;
+                    }
+
+                    edgeVolume[e] += updateEdgeFace(b, *q, sign, h[cell], z[cell], z[inner], n, dt, hmin);
+                }
+            }
+        }
+
+        // 水深の更新（最後の分割で降雨と浸透も同じループで入れる）
+        forEachTile(tiles, [&](const Tile& t) {
+            InertialUpdateSums sums;
+            for (int y = t.y0; y < t.y1; ++y) {
+                const double* qyN = qy + (size_t)y * W;       // 北側の面
+                const double* qyS = qy + (size_t)(y + 1) * W; // 南側の面
+                inertialUpdateRow(h + (size_t)y * W, qx + (size_t)y * (W + 1), qyN, qyS, t.x0, t.x1,
+                                  dt, DT, last && source, rain, infil, (size_t)y * W, sums);
+            }
+
+            st.tileMax[t.index] = sums.hmax;
+            st.tileClamp[t.index] += sums.clamp;
+            if (last && ledger) ledger->parts[t.index].infil = sums.infil.sum;
+        });
+    }
+
+    // 水深を書き戻す（ステップ開始時の水深との差の最大値も求める）
+    forEachTile(tiles, [&](const Tile& t) {
+        double dh = 0.0;
+        for (int y = t.y0; y < t.y1; ++y) {
+            const double* hr = h + (size_t)y * W;
+            double* wr = water[y].data();
+            for (int x = t.x0; x < t.x1; ++x) {
+                dh = max(dh, fabs(hr[x] - wr[x]));
+                wr[x] = hr[x];
+            }
+        }
+        if (ledger) {
+            ledger->parts[t.index].clamp = st.tileClamp[t.index];
+            ledger->parts[t.index].dhmax = dh;
+        }
+    });
+
+    // 境界からの流出量
+    double boundaryVolume = 0.0;
+    for (int e = 0; e < 4; ++e) {
+        if (opts.bflux) {
+            opts.bflux->step[e] = edgeVolume[e];
+            opts.bflux->total[e] += edgeVolume[e];
+        }
+        boundaryVolume += edgeVolume[e];
+    }
+
+    // 1次元の河道（領域外へ出た分は境界からの流出に含める）
+    if (ch) {
+        boundaryVolume += channelStep(*ch, water, DT);
+    }
+
+    // 上流からの流入（流入点のセルだけ）
+    double inflowVolume = 0.0;
+    if (opts.inflows) {
+        inflowVolume = applyInflows(*opts.inflows, water, opts.time, DT);
+    }
+
+    if (ledger) {
+        finishLedgerStep(*ledger, w * w, rain * w * w * W * H, inflowVolume, boundaryVolume, 0);
+    }
+}
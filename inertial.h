@@ -0,0 +1,128 @@
+﻿#ifndef INERTIAL_H
+#define INERTIAL_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "simulate.h"
+#include "tiling.h"
+#include "infiltration.h"
+#include "massbalance.h"
+
+using namespace std;
+
+// 局所慣性近似（LISFLOOD-FP, Bates et al. 2010）の状態
+// セルの値は y * width + x、面の流量は
+//   qx: (width + 1) * height  … 面 x はセル x-1 と x の間（+x 向きが正）
+//   qy: width * (height + 1)  … 面 y はセル y-1 と y の間（+y 向きが正）
+struct InertialState {
+    int width = 0;
+    int height = 0;
+    vector<double> z;  // 標高 [m]
+    vector<double> h;  // 水深 [m]
+    vector<double> qx; // x方向の単位幅流量 [m^2/s]
+    vector<double> qy; // y方向の単位幅流量 [m^2/s]
+
+    TileGrid tiles;            // タイル分割（タイルごとにスレッドに分ける）
+    vector<double> tileMax;    // タイルごとの最大水深（時間刻みを決める用）
+    vector<double> tileClamp;  // タイルごとの負の水深の補正量 [m]
+
+    double alpha = 0.7; // CFL係数
+    double hmin = 1e-6; // これ未満の水深は流さない
+    int substeps = 0;   // 直前のステップの分割数
+};
+
+// 面の流量の更新（Bates et al. 2010 の半陰的な摩擦項）
+// 0 側のセルから 1 側のセルへの向きが正
+inline double inertialFlux(double q, double eta0, double eta1, double z0, double z1, double n2, double dt, double hmin) {
+    const double g = 9.81; // 重力加速度 [m/s^2]
+    double hf = max(eta0, eta1) - max(z0, z1); // 面の水深
+    if (hf <= hmin) return 0.0;
+
+    double S = (eta1 - eta0) / w; // 水面勾配
+    double qn = (q - g * hf * dt * S) / (1.0 + g * dt * n2 * fabs(q) / pow(hf, 7.0 / 3.0));
+
+    // 急斜面で発散しないように限界流の流量で抑える
+    double qc = hf * sqrt(g * hf);
+    return (qn > qc) ? qc : ((qn < -qc) ? -qc : qn);
+}
+
+// 1行分の x方向の面 x0..x1-1 の更新（面 x はセル x-1 と x の間なので x0 >= 1, z, h はその行）
+// 全体のグリッド（simulateLocalInertial）と小領域（decomp.h）で同じものを使う
+inline void inertialXFaceRow(double* q, const double* z, const double* h, int x0, int x1, double n2, double dt, double hmin) {
+#pragma omp simd
+    for (int x = x0; x < x1; ++x) {
+        q[x] = inertialFlux(q[x], z[x - 1] + h[x - 1], z[x] + h[x], z[x - 1], z[x], n2, dt, hmin);
+    }
+}
+
+// 1行分の y方向の面 x0..x1-1 の更新（z0, h0 は北側の行, z1, h1 は南側の行）
+inline void inertialYFaceRow(double* q, const double* z0, const double* h0, const double* z1, const double* h1, int x0, int x1, double n2, double dt, double hmin) {
+#pragma omp simd
+    for (int x = x0; x < x1; ++x) {
+        q[x] = inertialFlux(q[x], z0[x] + h0[x], z1[x] + h1[x], z0[x], z1[x], n2, dt, hmin);
+    }
+}
+
+// 水深の更新の部分和（タイルごとに持つ）
+struct InertialUpdateSums {
+    KahanSum infil;     // 浸透量 [m]
+    double clamp = 0.0; // 負の水深の補正量 [m]
+    double hmax = 0.0;  // 最大水深
+};
+
+// 1行分の水深 x0..x1-1 の更新（source なら降雨 rain と浸透も同じループで入れる）
+// qxr: この行の x方向の面, qyN, qyS: 北側・南側の y方向の面
+// infil: 浸透の状態（nullptr なら浸透なし）, infilRow: この行の x = 0 のセルの浸透の状態の番号
+inline void inertialUpdateRow(double* h, const double* qxr, const double* qyN, const double* qyS, int x0, int x1,
+                              double dt, double DT, bool source, double rain, InfiltrationState* infil, size_t infilRow,
+                              InertialUpdateSums& sums) {
+    double clamp = sums.clamp;
+    double m = sums.hmax;
+    for (int x = x0; x < x1; ++x) {
+        double hn = h[x] + dt / w * (qxr[x] - qxr[x + 1] + qyN[x] - qyS[x]);
+
+        if (source) {
+            hn += rain;
+            if (infil) {
+                double loss = infiltrationStep(*infil, infilRow + x, rain, hn, DT);
+                hn -= loss;
+                sums.infil.add(loss);
+            }
+        }
+
+        // 流出しすぎて負になった分は0に戻す（水が増えるので帳簿に記録）
+        if (hn < 0.0) {
+            clamp -= hn;
+            hn = 0.0;
+        }
+        h[x] = hn;
+        m = max(m, hn);
+    }
+    sums.clamp = clamp;
+    sums.hmax = m;
+}
+
+// 外周の面の外向き流量 [m^2/s]（境界条件は boundary.h）
+// qOut: 前回の外向き流量, h, z: 外周セルの水深と標高, zInner: 1つ内側のセルの標高
+struct EdgeBoundary;
+double edgeFaceFlux(const EdgeBoundary& b, double qOut, double h, double z, double zInner, double n, double dt, double hmin);
+
+// 外周の面1つを境界条件で更新する（q: 面の流量, sign: 外向きの符号, 戻り値は流出量 [m^3]）
+// セルの水より多くは出さない
+double updateEdgeFace(const EdgeBoundary& b, double& q, double sign, double h, double z, double zInner, double n, double dt, double hmin);
+
+// 状態の作成（dem は川の掘り下げなどを済ませた標高）
+InertialState makeInertial(const vector<vector<double>>& dem, int width, int height);
+
+// 局所慣性近似で DT 秒進める（入出力は simulateWaterFlow と同じ水深の配列）
+// CFL条件で DT を細かく分けて計算する
+void simulateLocalInertial(
+    vector<vector<double>>& water,
+    InertialState& st,
+    int width, int height,
+    double DT, double n = 0.03,
+    const FlowOptions& opts = FlowOptions()
+);
+
+#endif // INERTIAL_H
@@ -0,0 +1,236 @@
+﻿#include "inertial_batch.h"
+#include "inertial.h"
+#include <cmath>
+#include <algorithm>
+
+static const double g = 9.81; // 重力加速度 [m/s^2]
+static const int K = BATCH_LANES;
+
+
+// 状態の作成
+BatchInertialState makeBatchInertial(const vector<vector<double>>& dem, int width, int height) {
+    BatchInertialState st;
+    st.width = width;
+    st.height = height;
+
+    size_t cells = (size_t)width * height;
+    st.z.resize(cells);
+    st.h.assign(cells * K, 0.0);
+    st.qx.assign((size_t)(width + 1) * height * K, 0.0);
+    st.qy.assign((size_t)width * (height + 1) * K, 0.0);
+    st.tiles = makeTileGrid(width, height, (1 + 3 * K) * sizeof(double)); // z と K 個ずつの h, qx, qy
+    st.tileMax.assign(st.tiles.count(), 0.0);
+    st.tileClamp.assign((size_t)st.tiles.count() * K, 0.0);
+
+    for (int k = 0; k < K; ++k) {
+        st.n[k] = 0.03;
+        st.rainfall[k] = 0.0;
+    }
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            st.z[(size_t)y * width + x] = dem[y][x];
+        }
+    }
+    return st;
+}
+
+void setBatchWater(BatchInertialState& st, int k, const vector<vector<double>>& water) {
+    for (int y = 0; y < st.height; ++y) {
+        for (int x = 0; x < st.width; ++x) {
+            st.h[((size_t)y * st.width + x) * K + k] = water[y][x];
+        }
+    }
+}
+
+void getBatchWater(const BatchInertialState& st, int k, vector<vector<double>>& water) {
+    water.assign(st.height, vector<double>(st.width, 0.0));
+    for (int y = 0; y < st.height; ++y) {
+        for (int x = 0; x < st.width; ++x) {
+            water[y][x] = st.h[((size_t)y * st.width + x) * K + k];
+        }
+    }
+}
+
+// 全シナリオを DT 秒進める
+void simulateBatchInertial(BatchInertialState& st, double DT, const BoundaryConfig* boundary) {
+    const int W = st.width;
+    const int H = st.height;
+    const double hmin = st.hmin;
+    const double* z = st.z.data();
+    double* h = st.h.data();
+    double* qx = st.qx.data();
+    double* qy = st.qy.data();
+
+    double n2[K];
+    for (int k = 0; k < K; ++k) n2[k] = st.n[k] * st.n[k];
+    const bool infil = !st.infil.empty();
+
+    const TileGrid& tiles = st.tiles;
+    for (int k = 0; k < K; ++k) beginLedgerStep(st.ledger[k], tiles.count());
+
+    // 貯留量と最大水深
+    forEachTile(tiles, [&](const Tile& t) {
+        KahanSum storage[K];
+        double m = 0.0;
+        for (int y = t.y0; y < t.y1; ++y) {
+            const double* hr = h + (size_t)y * W * K;
+            for (int x = t.x0; x < t.x1; ++x) {
+                for (int k = 0; k < K; ++k) {
+                    storage[k].add(hr[x * K + k]);
+                    m = max(m, hr[x * K + k]);
+                }
+            }
+        }
+        st.tileMax[t.index] = m;
+        for (int k = 0; k < K; ++k) {
+            st.tileClamp[(size_t)t.index * K + k] = 0.0;
+            st.ledger[k].parts[t.index].storage = storage[k].sum;
+        }
+    });
+    double hmax = *max_element(st.tileMax.begin(), st.tileMax.end());
+
+    // CFL条件から分割数を決める（全シナリオで同じ時間刻み）
+    double dtMax = (hmax > hmin) ? st.alpha * w / sqrt(g * hmax) : DT;
+    int nsub = max(1, (int)ceil(DT / dtMax));
+    double dt = DT / nsub;
+    st.substeps = nsub;
+
+    double edgeVolume[K][4] = {};
+
+    for (int s = 0; s < nsub; ++s) {
+        bool last = (s == nsub - 1);
+
+        // 内部の面（セルの西側と北側の面, 標高は1回読んで K 個のシナリオに使う）
+        forEachTile(tiles, [&](const Tile& t) {
+            const int xa = max(t.x0, 1);
+            for (int y = t.y0; y < t.y1; ++y) {
+                const double* z1 = z + (size_t)y * W;
+                const double* h1 = h + (size_t)y * W * K;
+
+                double* q = qx + (size_t)y * (W + 1) * K;
+                for (int x = xa; x < t.x1; ++x) {
+                    const double za = z1[x - 1], zb = z1[x];
+                    const double* ha = h1 + (size_t)(x - 1) * K;
+                    const double* hb = ha + K;
+                    double* qf = q + (size_t)x * K;
+#pragma omp simd
+                    for (int k = 0; k < K; ++k) {
+                        qf[k] = inertialFlux(qf[k], za + ha[k], zb + hb[k], za, zb, n2[k], dt, hmin);
+                    }
+                }
+
+                if (y == 0) continue;
+                const double* z0 = z1 - W;
+                const double* h0 = h1 - (size_t)W * K;
+                q = qy + (size_t)y * W * K;
+                for (int x = t.x0; x < t.x1; ++x) {
+                    const double za = z0[x], zb = z1[x];
+                    const double* ha = h0 + (size_t)x * K;
+                    const double* hb = h1 + (size_t)x * K;
+                    double* qf = q + (size_t)x * K;
+#pragma omp simd
+                    for (int k = 0; k < K; ++k) {
+                        qf[k] = inertialFlux(qf[k], za + ha[k], zb + hb[k], za, zb, n2[k], dt, hmin);
+                    }
+                }
+            }
+        });
+
+        // 外周の面（閉境界なら 0 のまま）
+        if (boundary) {
+            for (int e = 0; e < 4; ++e) {
+                const EdgeBoundary& b = boundary->edge[e];
+                if (b.type == BoundaryType::Closed) continue;
+
+                bool horizontal = (e == EDGE_NORTH || e == EDGE_SOUTH);
+                int count = horizontal ? W : H;
+                for (int i = 0; i < count; ++i) {
+                    size_t cell, inner, face;
+                    double* qe;
+                    double sign; // 外向きの符号
+                    if (e == EDGE_NORTH) { cell = i; inner = (size_t)W + i; face = i; qe = qy; sign = -1.0; }
+                    else if (e == EDGE_SOUTH) { cell = (size_t)(H - 1) * W + i; inner = cell - W; face = (size_t)H * W + i; qe = qy; sign = 1.0; }
+                    else if (e == EDGE_WEST) { cell = (size_t)i * W; inner = cell + 1; face = (size_t)i * (W + 1); qe = qx; sign = -1.0; }
+                    else { cell = (size_t)i * W + W - 1; inner = cell - 1; face = (size_t)i * (W + 1) + W; qe = qx; sign = 1.0; }
+
+                    for (int k = 0; k < K; ++k) {
+                        double& q = qe[face * K + k];
+                        double hc = h[cell * K + k];
+                        double qOut = edgeFaceFlux(b, sign * q, hc, z[cell], z[inner], st.n[k], dt, hmin);
+                        if (qOut > 0.0) qOut = min(qOut, hc * w / dt); // セルの水より多くは出さない
+                        q = sign * qOut;
+                        edgeVolume[k][e] += qOut * w * dt;
+                    }
+                }
+            }
+        }
+
+        // 水深の更新（最後の分割で降雨と浸透も入れる）
+        forEachTile(tiles, [&](const Tile& t) {
+            KahanSum infilSum[K];
+            double clamp[K] = {};
+            double m = 0.0;
+
+            for (int y = t.y0; y < t.y1; ++y) {
+                double* hr = h + (size_t)y * W * K;
+                const double* qxr = qx + (size_t)y * (W + 1) * K;
+                const double* qyN = qy + (size_t)y * W * K;       // 北側の面
+                const double* qyS = qy + (size_t)(y + 1) * W * K; // 南側の面
+
+                for (int x = t.x0; x < t.x1; ++x) {
+                    double* hc = hr + (size_t)x * K;
+                    const double* qw = qxr + (size_t)x * K;
+                    const double* qe = qw + K;
+                    const double* qn = qyN + (size_t)x * K;
+                    const double* qs = qyS + (size_t)x * K;
+                    double hn[K];
+#pragma omp simd
+                    for (int k = 0; k < K; ++k) {
+                        hn[k] = hc[k] + dt / w * (qw[k] - qe[k] + qn[k] - qs[k]);
+                    }
+
+                    if (last) {
+                        for (int k = 0; k < K; ++k) {
+                            hn[k] += st.rainfall[k];
+                            if (infil) {
+                                double loss = infiltrationStep(st.infil[k], (size_t)y * W + x, st.rainfall[k], hn[k], DT);
+                                hn[k] -= loss;
+                                infilSum[k].add(loss);
+                            }
+                        }
+                    }
+
+                    // 流出しすぎて負になった分は0に戻す
+                    for (int k = 0; k < K; ++k) {
+                        if (hn[k] < 0.0) {
+                            clamp[k] -= hn[k];
+                            hn[k] = 0.0;
+                        }
+                        hc[k] = hn[k];
+                        m = max(m, hn[k]);
+                    }
+                }
+            }
+
+            st.tileMax[t.index] = m;
+            for (int k = 0; k < K; ++k) {
+                st.tileClamp[(size_t)t.index * K + k] += clamp[k];
+                if (last) st.ledger[k].parts[t.index].infil = infilSum[k].sum;
+            }
+        });
+    }
+
+    // シナリオごとの境界からの流出量と水収支
+    for (int k = 0; k < K; ++k) {
+        double boundaryVolume = 0.0;
+        for (int e = 0; e < 4; ++e) {
+            st.bflux[k].step[e] = edgeVolume[k][e];
+            st.bflux[k].total[e] += edgeVolume[k][e];
+            boundaryVolume += edgeVolume[k][e];
+        }
+        for (int t = 0; t < tiles.count(); ++t) {
+            st.ledger[k].parts[t].clamp = st.tileClamp[(size_t)t * K + k];
+        }
+        finishLedgerStep(st.ledger[k], w * w, st.rainfall[k] * w * w * W * H, 0.0, boundaryVolume, 0);
+    }
+}
@@ -0,0 +1,54 @@
+﻿#ifndef INERTIAL_BATCH_H
+#define INERTIAL_BATCH_H
+
+#include <vector>
+#include "simulate.h"
+#include "tiling.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "massbalance.h"
+
+using namespace std;
+
+// 局所慣性近似を BATCH_LANES 個のシナリオでまとめて計算する（アンサンブル用）
+// 水深と面の流量はセルごとにシナリオの値を並べて持つ（AoSoA: [セル][シナリオ]）
+// 標高は全シナリオで1つなので1回読むだけで済み、シナリオ方向のループは SIMD の幅いっぱいに使える
+// 時間刻みは全シナリオの最大水深で決めて揃える（そのため1つずつ計算したときとは分割数が変わることがある）
+// 粗度係数・雨量・初期水深はシナリオごとに変えられる（流入点・河道・セルのフラグは未対応）
+
+const int BATCH_LANES = 4; // まとめるシナリオ数（AVX2 の double 4個分）
+
+struct BatchInertialState {
+    int width = 0;
+    int height = 0;
+    vector<double> z;  // 標高 [m]（シナリオで共通）
+    vector<double> h;  // 水深 [m] cells * BATCH_LANES
+    vector<double> qx; // x方向の単位幅流量 (width + 1) * height * BATCH_LANES
+    vector<double> qy; // y方向の単位幅流量 width * (height + 1) * BATCH_LANES
+
+    double n[BATCH_LANES];        // 粗度係数
+    double rainfall[BATCH_LANES]; // 1ステップあたりの降雨 [m]
+    vector<InfiltrationState> infil;     // シナリオごとの浸透（空なら浸透なし）
+    BoundaryFlux bflux[BATCH_LANES];     // シナリオごとの境界からの流出量
+    MassLedger ledger[BATCH_LANES];      // シナリオごとの水収支
+
+    TileGrid tiles;
+    vector<double> tileMax;   // タイルごとの最大水深（全シナリオ）
+    vector<double> tileClamp; // タイル・シナリオごとの負の水深の補正量 [m]
+
+    double alpha = 0.7; // CFL係数
+    double hmin = 1e-6; // これ未満の水深は流さない
+    int substeps = 0;   // 直前のステップの分割数
+};
+
+// 状態の作成（全シナリオとも水深 0, n = 0.03, 雨なし）
+BatchInertialState makeBatchInertial(const vector<vector<double>>& dem, int width, int height);
+
+// シナリオ k の水深の設定と取り出し
+void setBatchWater(BatchInertialState& st, int k, const vector<vector<double>>& water);
+void getBatchWater(const BatchInertialState& st, int k, vector<vector<double>>& water);
+
+// 全シナリオを DT 秒進める
+void simulateBatchInertial(BatchInertialState& st, double DT, const BoundaryConfig* boundary = nullptr);
+
+#endif // INERTIAL_BATCH_H
@@ -0,0 +1,89 @@
+﻿#ifndef INFILTRATION_H
+#define INFILTRATION_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+
+using namespace std;
+
+// 浸透モデルの種類
+enum class InfiltrationModel {
+    GreenAmpt, // Green-Ampt式
+    SCS        // SCSカーブナンバー法
+};
+
+// 土壌クラスのパラメータ
+struct SoilClass {
+    double Ks;     // 飽和透水係数 [m/s]
+    double psi;    // 湿潤前線の毛管水頭 [m]
+    double dtheta; // 含水率の不足分（有効間隙率 - 初期含水率）[-]
+    double CN;     // カーブナンバー（SCS用）
+};
+
+// 土壌クラスから前計算した係数（カーネル内で割り算をしないため）
+struct SoilCoef {
+    double Ks;        // 飽和透水係数 [m/s]
+    double psiDtheta; // psi * dtheta [m]
+    double S;         // 最大保留量 [m]（SCS）
+    double Ia;        // 初期損失 [m]（SCS）
+};
+
+// 浸透の状態（セルごとの値は y * width + x の1次元配列で持つ）
+struct InfiltrationState {
+    InfiltrationModel model = InfiltrationModel::GreenAmpt;
+    int width = 0;
+    int height = 0;
+    vector<SoilClass> classes;       // 土壌クラス表
+    vector<SoilCoef> coef;           // classes から作った係数表
+    vector<unsigned char> soilClass; // セルごとの土壌クラス番号
+    vector<double> cumInfil;         // 累積浸透量 F [m]
+    vector<double> cumRain;          // 累積降雨量 P [m]（SCSのみ使用）
+};
+
+// 標準の土壌クラス表（0:水域・不浸透, 1:砂, 2:ローム, 3:埴壌土, 4:粘土）
+vector<SoilClass> defaultSoilClasses();
+
+// 浸透状態の作成（全セルを defaultClass で初期化）
+InfiltrationState makeInfiltration(int width, int height, InfiltrationModel model, unsigned char defaultClass = 2);
+
+// classes を変更したときに係数表を作り直す
+void updateSoilCoef(InfiltrationState& st);
+
+// 土壌クラスのラスタ（カンマ区切りの整数, 1行 = 1行分のセル）を読み込む
+bool loadSoilClasses(const string& filename, InfiltrationState& st);
+
+// 1ステップの浸透量 [m]
+// rain: このステップの降雨 [m], avail: 浸透に使える水深 [m]
+inline double infiltrationStep(InfiltrationState& st, size_t i, double rain, double avail, double dt) {
+    if (avail <= 0.0) return 0.0;
+    const SoilCoef& c = st.coef[st.soilClass[i]];
+    double F = st.cumInfil[i];
+    double dF;
+
+    if (st.model == InfiltrationModel::GreenAmpt) {
+        if (c.Ks <= 0.0) return 0.0;
+        // f = Ks (1 + psi*dtheta / F) を F + dF/2 で評価した式を dF について解く（F = 0 でも発散しない）
+        double a = c.Ks * dt;
+        double b = F - 0.5 * a;
+        dF = -b + sqrt(b * b + 2.0 * a * (F + c.psiDtheta));
+    }
+    else {
+        // 累積降雨 P から累積浸透 P - Q を求め、前回との差をこのステップの浸透とする
+        double P = st.cumRain[i] + rain;
+        st.cumRain[i] = P;
+        double Fpot = P;
+        if (P > c.Ia) {
+            double pe = P - c.Ia;
+            Fpot = P - pe * pe / (pe + c.S);
+        }
+        dF = Fpot - F;
+        if (dF <= 0.0) return 0.0;
+    }
+
+    double loss = (dF < avail) ? dF : avail;
+    st.cumInfil[i] = F + loss;
+    return loss;
+}
+
+#endif // INFILTRATION_H
@@ -0,0 +1,221 @@
+﻿#include "inflow.h"
+#include "simulate.h"
+#include "tinyxml2.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+
+using namespace tinyxml2;
+
+
+// 時刻 t の流量
+double Hydrograph::at(double t) {
+    if (time.empty()) return 0.0;
+    if (t <= time.front()) return discharge.front();
+    if (t >= time.back()) return discharge.back();
+
+    if (cursor >= time.size() - 1 || time[cursor] > t) cursor = 0; // 時間が戻ったときは最初から
+    while (time[cursor + 1] < t) cursor++;
+
+    double t0 = time[cursor], t1 = time[cursor + 1];
+    double r = (t1 > t0) ? (t - t0) / (t1 - t0) : 0.0;
+    return discharge[cursor] + r * (discharge[cursor + 1] - discharge[cursor]); // 線形補間
+}
+
+// 緯度経度からセルを求める
+bool GridGeoref::cellOf(double lat, double lon, int& y, int& x) const {
+    if (width <= 0 || height <= 0) return false;
+    double dlat = (latMax - latMin) / height;
+    double dlon = (lonMax - lonMin) / width;
+
+    // 1行目が北端（sequenceRule +x-y）
+    y = (int)floor((latMax - lat) / dlat);
+    x = (int)floor((lon - lonMin) / dlon);
+    return (y >= 0 && y < height && x >= 0 && x < width);
+}
+
+// 点を追加
+void InflowSource::addPoint(int y, int x) {
+    for (const auto& c : cells) {
+        if (c.first == y && c.second == x) return; // 同じセルは1回だけ
+    }
+    cells.emplace_back(y, x);
+    normalizeWeights();
+}
+
+// 2点を結ぶ線上のセルを追加（ブレゼンハム）
+void InflowSource::addLine(int y0, int x0, int y1, int x1) {
+    int dx = abs(x1 - x0), sx = (x0 < x1) ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = (y0 < y1) ? 1 : -1;
+    int err = dx + dy;
+
+    while (true) {
+        addPoint(y0, x0);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+}
+
+// 配分を均等にする
+void InflowSource::normalizeWeights() {
+    weights.assign(cells.size(), cells.empty() ? 0.0 : 1.0 / cells.size());
+}
+
+// ハイドログラフの読み込み
+bool loadHydrograph(const string& filename, Hydrograph& hydro) {
+    ifstream file(filename);
+    if (!file) {
+        cerr << "ハイドログラフを開けません: " << filename << endl;
+        return false;
+    }
+
+    hydro.time.clear();
+    hydro.discharge.clear();
+    hydro.cursor = 0;
+
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        size_t comma = line.find(',');
+        if (comma == string::npos) continue;
+
+        char* end = nullptr;
+        double t = strtod(line.c_str(), &end);
+        if (end == line.c_str()) continue; // 見出し行など
+        double q = atof(line.c_str() + comma + 1);
+
+        if (!hydro.time.empty() && t < hydro.time.back()) {
+            cerr << "ハイドログラフの時刻が昇順ではありません: " << filename << endl;
+            return false;
+        }
+        hydro.time.push_back(t);
+        hydro.discharge.push_back(q);
+    }
+    return !hydro.time.empty();
+}
+
+// タイルの位置情報の読み込み
+bool loadGridGeoref(const string& xmlFile, GridGeoref& geo) {
+    XMLDocument doc;
+    if (doc.LoadFile(xmlFile.c_str()) != XML_SUCCESS) {
+        cerr << "XML読み込み失敗: " << doc.ErrorStr() << endl;
+        return false;
+    }
+
+    XMLElement* coverage = nullptr;
+    if (XMLElement* root = doc.FirstChildElement("Dataset")) {
+        if (XMLElement* dem = root->FirstChildElement("DEM")) coverage = dem->FirstChildElement("coverage");
+    }
+    if (!coverage) {
+        cerr << "coverageが見つかりません\n";
+        return false;
+    }
+
+    XMLElement* envelope = coverage->FirstChildElement("gml:boundedBy");
+    if (envelope) envelope = envelope->FirstChildElement("gml:Envelope");
+    XMLElement* grid = coverage->FirstChildElement("gml:gridDomain");
+    if (grid) grid = grid->FirstChildElement("gml:Grid");
+    if (grid) grid = grid->FirstChildElement("gml:limits");
+    if (grid) grid = grid->FirstChildElement("gml:GridEnvelope");
+    if (!envelope || !grid) {
+        cerr << "EnvelopeまたはGridEnvelopeが見つかりません\n";
+        return false;
+    }
+
+    const char* lower = envelope->FirstChildElement("gml:lowerCorner") ? envelope->FirstChildElement("gml:lowerCorner")->GetText() : nullptr;
+    const char* upper = envelope->FirstChildElement("gml:upperCorner") ? envelope->FirstChildElement("gml:upperCorner")->GetText() : nullptr;
+    const char* high = grid->FirstChildElement("gml:high") ? grid->FirstChildElement("gml:high")->GetText() : nullptr;
+    if (!lower || !upper || !high) {
+        cerr << "位置情報のテキストがありません\n";
+        return false;
+    }
+
+    istringstream(lower) >> geo.latMin >> geo.lonMin;
+    istringstream(upper) >> geo.latMax >> geo.lonMax;
+    int hx = 0, hy = 0;
+    istringstream(high) >> hx >> hy;
+    geo.width = hx + 1;
+    geo.height = hy + 1;
+    return true;
+}
+
+// 流入点の設定ファイルの読み込み
+vector<InflowSource> loadInflowSources(const string& filename, const GridGeoref& geo) {
+    vector<InflowSource> sources;
+
+    ifstream file(filename);
+    if (!file) {
+        cerr << "流入点ファイルを開けません: " << filename << endl;
+        return sources;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        vector<string> item;
+        istringstream iss(line);
+        string s;
+        while (getline(iss, s, ',')) item.push_back(s);
+        if (item.size() != 4 && item.size() != 6) {
+            cerr << "流入点の形式が違います: " << line << endl;
+            continue;
+        }
+
+        InflowSource src;
+        src.name = item[0];
+        if (!loadHydrograph(item[1], src.hydro)) continue;
+
+        int y0, x0, y1, x1;
+        bool in0 = geo.cellOf(atof(item[2].c_str()), atof(item[3].c_str()), y0, x0);
+        if (item.size() == 4) {
+            if (!in0) continue; // このタイルの流入点ではない
+            src.addPoint(y0, x0);
+        }
+        else {
+            geo.cellOf(atof(item[4].c_str()), atof(item[5].c_str()), y1, x1);
+            // タイルの境界をまたぐ線は、タイル内のセルだけ残す
+            InflowSource line;
+            line.addLine(y0, x0, y1, x1);
+            for (const auto& c : line.cells) {
+                if (c.first >= 0 && c.first < geo.height && c.second >= 0 && c.second < geo.width) {
+                    src.addPoint(c.first, c.second);
+                }
+            }
+            if (src.cells.empty()) continue;
+        }
+
+        cout << "流入点: " << src.name << " (" << src.cells.size() << "セル)\n";
+        sources.push_back(src);
+    }
+    return sources;
+}
+
+// DT 秒間の流入量
+double advanceInflow(InflowSource& src, double time, double DT) {
+    // ステップ内の平均流量（台形）
+    double Q = 0.5 * (src.hydro.at(time) + src.hydro.at(time + DT));
+    double volume = Q * DT;
+    src.stepVolume = volume;
+    src.totalVolume += volume;
+    return volume;
+}
+
+// 流入を水深に加える
+double applyInflows(vector<InflowSource>& sources, vector<vector<double>>& water, double time, double DT) {
+    const double cellArea = w * w;
+    double total = 0.0;
+
+    for (auto& src : sources) {
+        double volume = advanceInflow(src, time, DT);
+        for (size_t k = 0; k < src.cells.size(); ++k) {
+            water[src.cells[k].first][src.cells[k].second] += volume * src.weights[k] / cellArea;
+        }
+        total += volume;
+    }
+    return total;
+}
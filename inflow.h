@@ -0,0 +1,60 @@
+﻿#ifndef INFLOW_H
+#define INFLOW_H
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// 流入ハイドログラフ（時刻 [s] と流量 [m^3/s] の折れ線）
+struct Hydrograph {
+    vector<double> time;      // 時刻 [s]（昇順）
+    vector<double> discharge; // 流量 [m^3/s]
+    size_t cursor = 0;        // 前回参照した区間（時刻は基本的に進むだけなので毎回探さない）
+
+    // 時刻 t の流量（範囲外は端の値）
+    double at(double t);
+};
+
+// タイルの位置情報（XMLの gml:Envelope と gml:GridEnvelope）
+struct GridGeoref {
+    double latMin = 0.0, lonMin = 0.0; // 南西の角
+    double latMax = 0.0, lonMax = 0.0; // 北東の角
+    int width = 0, height = 0;         // セル数
+
+    // 緯度経度からセルを求める（タイルの外なら false）
+    bool cellOf(double lat, double lon, int& y, int& x) const;
+};
+
+// 流入点（点または線上のセルにハイドログラフの流量を配る）
+struct InflowSource {
+    string name;
+    Hydrograph hydro;
+    vector<pair<int, int>> cells; // 流入させるセル (y, x)
+    vector<double> weights;       // セルごとの配分（合計1）
+    double stepVolume = 0.0;      // このステップの流入量 [m^3]
+    double totalVolume = 0.0;     // 累積の流入量 [m^3]
+
+    void addPoint(int y, int x);
+    void addLine(int y0, int x0, int y1, int x1); // 2点を結ぶ線上のセル
+    void normalizeWeights();                      // 配分を均等にする
+};
+
+// ハイドログラフの読み込み（1行に「時刻[s],流量[m3/s]」）
+bool loadHydrograph(const string& filename, Hydrograph& hydro);
+
+// タイルの位置情報の読み込み
+bool loadGridGeoref(const string& xmlFile, GridGeoref& geo);
+
+// 流入点の設定ファイルの読み込み
+// 1行に「名前,ハイドログラフのファイル,緯度,経度[,緯度,経度]」（2点目があれば線）
+// タイルの外にある流入点は読み飛ばす（複数タイルのときはタイルごとに同じファイルを読めばよい）
+vector<InflowSource> loadInflowSources(const string& filename, const GridGeoref& geo);
+
+// 時刻 time から DT 秒間の流入量 [m^3]（stepVolume と totalVolume も進める）
+double advanceInflow(InflowSource& src, double time, double DT);
+
+// 時刻 time から DT 秒間の流入を水深に加える（戻り値は流入量の合計 [m^3]）
+double applyInflows(vector<InflowSource>& sources, vector<vector<double>>& water, double time, double DT);
+
+#endif // INFLOW_H
@@ -0,0 +1,125 @@
+﻿#include "initial.h"
+#include "simulate.h"
+#include "checkpoint.h"
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+static const double DEG2RAD = 3.14159265358979323846 / 180.0;
+
+// 基底流の定常状態の水深
+vector<vector<double>> baseflowDepth(const vector<vector<double>>& dem, const FlowAccumulation& acc, const vector<float>& slope, const CellFlags& flags, const BaseflowOptions& opt) {
+    const int W = acc.width;
+    const int H = acc.height;
+    vector<vector<double>> water(H, vector<double>(W, 0.0));
+    const double cellArea = w * w;
+
+    // 等流水深：Q = h^(5/3) * sqrt(S) * w / n
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            size_t i = (size_t)y * W + x;
+            if (acc.count[i] < opt.minCells) continue;
+            double Q = opt.specificDischarge * acc.count[i] * cellArea / 1e6; // [m^3/s]
+            double S = max(tan(slope[i] * DEG2RAD), opt.minSlope);
+            water[y][x] = pow(Q * opt.n / (w * sqrt(S)), 0.6);
+        }
+    }
+
+    // 水域は一番低い岸（隣の陸のセル）の高さまで満たす
+    if (opt.fillWaterBodies && flags.waterBodies > 0) {
+        vector<double> shore(flags.waterBodies + 1, HUGE_VAL);
+        const int dx[4] = { 1, -1, 0, 0 };
+        const int dy[4] = { 0, 0, 1, -1 };
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                uint32_t id = flags.waterBody[(size_t)y * W + x];
+                if (id == 0) continue;
+                if (x == 0 || x == W - 1 || y == 0 || y == H - 1) { // 端から外へ流れ出る（端のセルの水面が岸になる）
+                    shore[id] = min(shore[id], dem[y][x] + water[y][x]);
+                }
+                for (int k = 0; k < 4; ++k) {
+                    int nx = x + dx[k], ny = y + dy[k];
+                    if (nx < 0 || nx >= W || ny < 0 || ny >= H) continue;
+                    if (flags.waterBody[(size_t)ny * W + nx] != 0) continue;
+                    shore[id] = min(shore[id], dem[ny][nx]);
+                }
+            }
+        }
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                uint32_t id = flags.waterBody[(size_t)y * W + x];
+                if (id == 0 || shore[id] == HUGE_VAL) continue; // 岸のない水域（全面が水域）はそのまま
+                water[y][x] = max(water[y][x], shore[id] - dem[y][x]);
+            }
+        }
+    }
+    return water;
+}
+
+// 基底流を保つ流入
+InflowSource baseflowRecharge(const FlowAccumulation& acc, const BaseflowOptions& opt) {
+    const int W = acc.width;
+    const size_t N = (size_t)acc.width * acc.height;
+    const double cellArea = w * w;
+
+    // 川のセルの集水面積の増分（自分の累積セル数から上流の川のセルの分を引く）
+    // 川のセルの流下先も川のセル（累積セル数は下流ほど多い）なので、1回なめれば済む
+    vector<double> lateral(N, 0.0);
+    for (size_t i = 0; i < N; ++i) {
+        if (acc.count[i] >= opt.minCells) lateral[i] += acc.count[i];
+    }
+    for (size_t i = 0; i < N; ++i) {
+        if (acc.count[i] < opt.minCells || acc.down[i] == FLOW_NONE) continue;
+        lateral[acc.down[i]] -= acc.count[i];
+    }
+
+    InflowSource src;
+    src.name = "基底流";
+    double cells = 0.0;
+    for (size_t i = 0; i < N; ++i) {
+        if (lateral[i] <= 0.0) continue;
+        src.cells.push_back(make_pair((int)(i / W), (int)(i % W)));
+        src.weights.push_back(lateral[i]);
+        cells += lateral[i];
+    }
+    for (double& v : src.weights) v /= cells;
+
+    src.hydro.time.push_back(0.0);
+    src.hydro.discharge.push_back(opt.specificDischarge * cells * cellArea / 1e6); // [m^3/s]
+    return src;
+}
+
+// 1行に1セルずつ並べた CSV（makeCsv の形式）
+static bool loadWaterCsv(const string& filename, int width, int height, vector<vector<double>>& water) {
+    ifstream file(filename);
+    if (!file) {
+        cerr << "初期水深のファイルを開けません: " << filename << endl;
+        return false;
+    }
+    vector<vector<double>> loaded(height, vector<double>(width, 0.0));
+    size_t n = 0;
+    double v;
+    while (file >> v) {
+        if (n < (size_t)width * height) loaded[n / width][n % width] = max(v, 0.0);
+        ++n;
+    }
+    if (n != (size_t)width * height) {
+        cerr << "初期水深のセル数が違います（" << n << "）: " << filename << endl;
+        return false;
+    }
+    water.swap(loaded);
+    return true;
+}
+
+// 保存した水深の読み込み
+bool loadInitialWater(const string& filename, int width, int height, vector<vector<double>>& water) {
+    if (isCheckpointFile(filename)) {
+        vector<vector<double>> loaded(height, vector<double>(width, 0.0));
+        if (!loadCheckpointWater(filename, width, height, w, loaded)) return false;
+        water.swap(loaded);
+        return true;
+    }
+    return loadWaterCsv(filename, width, height, water);
+}
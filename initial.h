@@ -0,0 +1,46 @@
+﻿#ifndef INITIAL_H
+#define INITIAL_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "flowacc.h"
+#include "cellflags.h"
+#include "inflow.h"
+
+using namespace std;
+
+// 初期水深
+// 全域に同じ水深を置くと、最初の数千ステップはその水が抜けるだけになるので、
+// 基底流の定常状態や前の計算の状態から始められるようにする
+enum class InitialWater {
+    Uniform,  // 全域に同じ水深
+    Baseflow, // 基底流の定常状態（流量累積から等流水深を求め、水域は岸の高さまで満たす, 計算中は baseflowRecharge で流量を保つ）
+    Snapshot  // 保存した状態（チェックポイントか makeCsv の water.csv）
+};
+
+struct BaseflowOptions {
+    double specificDischarge = 0.02; // 比流量 [m^3/s/km^2]
+    double n = 0.035;                // 粗度係数
+    double minSlope = 1e-3;          // 最小勾配（平坦なセルでも水深が決まるように）
+    uint32_t minCells = 400;         // 水を置く累積セル数（これより上流の少ないセルは乾いたまま）
+    bool fillWaterBodies = true;     // 水域を一番低い岸の高さまで満たす
+};
+
+// 基底流の定常状態の水深（O(N)）
+// 累積セル数 >= minCells のセルに、集水面積 x 比流量 の流量が流れるときの等流水深（セル幅の広い矩形断面, マニング式）を置く
+// 水域は一番低い岸の高さまで満たす（グリッドの端にかかる水域は端から流れ出るので、端のセルの水面の高さまで）
+// slope: 傾斜角 [度]（computeTerrain の slope）
+vector<vector<double>> baseflowDepth(const vector<vector<double>>& dem, const FlowAccumulation& acc, const vector<float>& slope, const CellFlags& flags, const BaseflowOptions& opt = BaseflowOptions());
+
+// 基底流を保つ流入（O(N)）
+// 水を置いた川のセル（累積セル数 >= minCells）に、川でない上流から入る分（集水面積の増分 x 比流量）を配る
+// どの川のセルでも流量が 集水面積 x 比流量 になるので、局所慣性近似では baseflowDepth の水深が定常になる
+// （D8 エンジンは水域の水面を平らに保たないので、水域の水は少しずつ流れ出る）
+// 流量は一定（ハイドログラフは1点）, 流入点と同じように opts.inflows に加えて使う
+InflowSource baseflowRecharge(const FlowAccumulation& acc, const BaseflowOptions& opt = BaseflowOptions());
+
+// 保存した水深の読み込み（チェックポイントか、1行に1セルずつ行優先で並べた CSV）
+bool loadInitialWater(const string& filename, int width, int height, vector<vector<double>>& water);
+
+#endif // INITIAL_H
@@ -0,0 +1,78 @@
+﻿#include "massbalance.h"
+#include <cmath>
+#include <algorithm>
+
+
+// 部分和を2つずつまとめる（pairwise）
+static MassPartial pairwiseSum(const vector<MassPartial>& v, size_t lo, size_t hi) {
+    MassPartial s;
+    if (hi - lo <= 8) {
+        for (size_t i = lo; i < hi; ++i) {
+            s.storage += v[i].storage;
+            s.infil += v[i].infil;
+            s.clamp += v[i].clamp;
+            s.wet += v[i].wet;
+            s.dhmax = max(s.dhmax, v[i].dhmax);
+            s.hmax = max(s.hmax, v[i].hmax);
+        }
+        return s;
+    }
+
+    size_t mid = lo + (hi - lo) / 2;
+    MassPartial a = pairwiseSum(v, lo, mid);
+    MassPartial b = pairwiseSum(v, mid, hi);
+    s.storage = a.storage + b.storage;
+    s.infil = a.infil + b.infil;
+    s.clamp = a.clamp + b.clamp;
+    s.wet = a.wet + b.wet;
+    s.dhmax = max(a.dhmax, b.dhmax);
+    s.hmax = max(a.hmax, b.hmax);
+    return s;
+}
+
+// ステップの始めに部分和を用意する
+void beginLedgerStep(MassLedger& ledger, int parts) {
+    ledger.parts.assign(parts, MassPartial());
+}
+
+// ステップの終わりに部分和をまとめる
+void finishLedgerStep(MassLedger& ledger, double cellArea, double rainVolume, double inflowVolume, double boundaryVolume, long long limited) {
+    MassPartial s = pairwiseSum(ledger.parts, 0, ledger.parts.size());
+
+    // 貯留量はステップ開始時の値なので、直前のステップまでの流入出と比べる
+    double storage = s.storage * cellArea;
+    if (!ledger.started) {
+        ledger.initialStorage = storage;
+        ledger.started = true;
+    }
+    ledger.storage = storage;
+    ledger.error = storage - (ledger.initialStorage + ledger.prevIn - ledger.prevOut);
+
+    // このステップの分を足す
+    ledger.rainIn += rainVolume;
+    ledger.inflowIn += inflowVolume;
+    ledger.infilOut += s.infil * cellArea;
+    ledger.boundaryOut += boundaryVolume;
+    ledger.clampIn += s.clamp * cellArea;
+    ledger.limited += limited;
+    ledger.steps++;
+    ledger.wetArea = s.wet * cellArea;
+    ledger.maxChange = s.dhmax;
+    ledger.maxDepth = s.hmax;
+
+    ledger.prevIn = ledger.rainIn + ledger.inflowIn + ledger.clampIn;
+    ledger.prevOut = ledger.infilOut + ledger.boundaryOut;
+}
+
+// 水収支の表示
+bool reportMassBalance(const MassLedger& ledger, int step, ostream& os) {
+    if (ledger.interval <= 0 || step % ledger.interval != 0 || !ledger.started) return false;
+
+    double rel = (ledger.initialStorage > 0.0) ? ledger.error / ledger.initialStorage : 0.0;
+    os << "[水収支 " << step << "] 貯留:" << ledger.storage << "m3"
+        << " 降雨:" << ledger.rainIn << " 流入:" << ledger.inflowIn
+        << " 浸透:" << ledger.infilOut << " 境界流出:" << ledger.boundaryOut
+        << " 補正:" << ledger.clampIn << " 誤差:" << ledger.error << "m3 (" << rel * 100.0 << "%)"
+        << " 制限セル:" << ledger.limited << "\n";
+    return true;
+}
@@ -0,0 +1,71 @@
+﻿#ifndef MASSBALANCE_H
+#define MASSBALANCE_H
+
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+// 補正付きの足し算（Kahan）
+struct KahanSum {
+    double sum = 0.0;
+    double c = 0.0; // 丸めで失った分
+
+    void add(double v) {
+        double y = v - c;
+        double t = sum + y;
+        c = (t - sum) - y;
+        sum = t;
+    }
+};
+
+// 1タイル分の部分和（タイルごとに持つので、タイルをスレッドに分けても結果は同じ）[m]
+struct MassPartial {
+    double storage = 0.0; // ステップ開始時の水深の合計
+    double infil = 0.0;   // 浸透の合計
+    double clamp = 0.0;   // 負の水深を0にしたときに足した水深の合計
+    double wet = 0.0;     // ステップ開始時に水のあるセル数（CELL_DRY を付け直すときに数える）
+    double dhmax = 0.0;   // このステップの水深の変化の最大値（合計ではなく最大）
+    double hmax = 0.0;    // ステップ開始時の最大水深（合計ではなく最大）
+};
+
+// 水収支の帳簿 [m^3]
+struct MassLedger {
+    int interval = 100; // 何ステップごとに報告するか
+
+    bool started = false;
+    int steps = 0;                // 記録したステップ数
+    double initialStorage = 0.0;  // 最初のステップ開始時の貯留量
+    double storage = 0.0;         // 最新のステップ開始時の貯留量
+    double error = 0.0;           // storage - (initialStorage + 流入 - 流出)
+
+    // 累積（最新のステップの分まで）
+    double rainIn = 0.0;      // 降雨
+    double inflowIn = 0.0;    // 流入点
+    double infilOut = 0.0;    // 浸透
+    double boundaryOut = 0.0; // 境界からの流出（流入は負）
+    double clampIn = 0.0;     // 負の水深の補正で増えた分
+    long long limited = 0;    // 流出量を制限したセル数の累計
+
+    // 最新のステップ（収束の判定と保存のタイミング用, convergence.h, output.h）
+    double wetArea = 0.0;   // ステップ開始時の浸水面積 [m^2]（セルのフラグを使うときだけ）
+    double maxChange = 0.0; // 水深の変化の最大値 [m]
+    double maxDepth = 0.0;  // ステップ開始時の最大水深 [m]
+
+    // 直前までの累積（storage と比べる用）
+    double prevIn = 0.0;
+    double prevOut = 0.0;
+
+    vector<MassPartial> parts; // タイルごとの部分和
+};
+
+// ステップの始めに部分和を用意する（parts: タイルの数）
+void beginLedgerStep(MassLedger& ledger, int parts);
+
+// ステップの終わりに部分和をまとめる（部分和以外の流入出は引数で渡す）[m^3]
+void finishLedgerStep(MassLedger& ledger, double cellArea, double rainVolume, double inflowVolume, double boundaryVolume, long long limited);
+
+// interval ごとに水収支を表示する（表示したら true）
+bool reportMassBalance(const MassLedger& ledger, int step, ostream& os = cout);
+
+#endif // MASSBALANCE_H
@@ -0,0 +1,174 @@
+﻿#include "mfd.h"
+#include "simulate.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+
+// 方向ごとの係数
+struct MfdCoef {
+    float invDist[8]; // 1 / セル中心間の距離
+    float contour[8]; // 等高線長（Quinn）, Freeman は 1
+    float p;          // 指数
+    bool usePow;      // 指数が 1 でないか
+};
+
+static MfdCoef makeCoef(const MfdWeights& mfd) {
+    MfdCoef c;
+    for (int d = 0; d < 8; ++d) {
+        bool diag = (dxc[d] != 0 && dyc[d] != 0);
+        c.invDist[d] = (float)(1.0 / (diag ? w * sqrt(2.0) : w));
+        c.contour[d] = (mfd.method == MfdMethod::Quinn) ? (diag ? 0.354f : 0.5f) : 1.0f;
+    }
+    c.p = (float)mfd.exponent;
+    c.usePow = (mfd.method == MfdMethod::Freeman && mfd.exponent != 1.0);
+    return c;
+}
+
+// s^p の近似（s >= 0, s = 0 なら 0）
+// s^p = s * 2^((p-1) log2 s) とし、log2 と 2^x を多項式で近似する（分岐がないのでベクトル化できる）
+// p - 1 が小さいので log2 の誤差は (p-1) 倍に縮み、相対誤差は 1e-3 程度（配分は 1/255 単位なので十分）
+// 1 <= p <= 1.8 なら 2^x の指数は範囲内に収まるので、範囲の確認はしない
+static inline float fastPow(float s, float p) {
+    uint32_t i;
+    memcpy(&i, &s, sizeof(i));
+    float e = (float)((int)((i >> 23) & 255) - 128); // 下の多項式は log2(m) + 1 を近似するので -128
+    i = (i & 0x007FFFFFu) | 0x3F800000u;
+    float m;
+    memcpy(&m, &i, sizeof(m));                                     // 仮数 [1, 2)
+    float lg = e + ((-0.34484843f * m + 2.02466578f) * m - 0.67487759f); // log2(s)
+
+    float t = (p - 1.0f) * lg;
+    int32_t ti = (int32_t)(t + 127.0f) - 127;                        // floor（正にしてから切り捨て）
+    float f = t - (float)ti;                                         // [0, 1)
+    float ex = 1.0f + f * (0.69606564f + f * (0.22449433f + f * 0.07944023f)); // 2^f
+    uint32_t bits = (uint32_t)(ti + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));                            // 2^ti
+    return s * ex * scale;
+}
+
+// 1セル分の配分を 0..255 の整数にする（丸めのずれは最大の方向で調整）
+static inline void quantize(const float f[8], unsigned char* out) {
+    float sum = 0.0f;
+    for (int d = 0; d < 8; ++d) sum += f[d];
+    if (sum <= 0.0f) {
+        for (int d = 0; d < 8; ++d) out[d] = 0; // 流れ出る方向なし
+        return;
+    }
+
+    float scale = 255.0f / sum;
+    int total = 0;
+    int best = 0;
+    for (int d = 0; d < 8; ++d) {
+        int v = (int)(f[d] * scale + 0.5f);
+        out[d] = (unsigned char)v;
+        total += v;
+        if (f[d] > f[best]) best = d;
+    }
+    out[best] = (unsigned char)(out[best] + (255 - total));
+}
+
+// 外周のセル（領域外の方向は使わない）
+static void borderCell(const vector<vector<double>>& surface, int y, int x, int W, int H, const MfdCoef& c, unsigned char* out, float* smax) {
+    float f[8];
+    *smax = 0.0f;
+    for (int d = 0; d < 8; ++d) {
+        int nx = x + dxc[d];
+        int ny = y + dyc[d];
+        f[d] = 0.0f;
+        if (nx < 0 || nx >= W || ny < 0 || ny >= H) continue;
+
+        float s = (float)((surface[y][x] - surface[ny][nx]) * c.invDist[d]);
+        if (s <= 0.0f) continue;
+        if (s > *smax) *smax = s;
+        f[d] = (c.usePow ? fastPow(s, c.p) : s) * c.contour[d];
+    }
+    quantize(f, out);
+}
+
+// 配分表の準備
+MfdWeights makeMfdWeights(int width, int height, MfdMethod method) {
+    MfdWeights mfd;
+    mfd.width = width;
+    mfd.height = height;
+    mfd.method = method;
+    mfd.exponent = (method == MfdMethod::Freeman) ? 1.1 : 1.0;
+    mfd.weights.assign((size_t)width * height * 8, 0);
+    mfd.slope.assign((size_t)width * height, 0.0f);
+    mfd.tiles = makeTileGrid(width, height, sizeof(double) + 8 + sizeof(float));
+    return mfd;
+}
+
+// 水面から配分表を計算する
+void computeMfdWeights(const vector<vector<double>>& surface, MfdWeights& mfd) {
+    const int W = mfd.width;
+    const int H = mfd.height;
+    const MfdCoef c = makeCoef(mfd);
+    const TileGrid& tiles = mfd.tiles;
+    const int n = tiles.count();
+
+#pragma omp parallel
+    {
+        vector<float> work((size_t)tiles.tileCols * 8); // タイル1行分の作業領域（8方向 × タイルの幅, スレッドごと）
+
+#pragma omp for schedule(dynamic)
+        for (int t = 0; t < n; ++t) {
+            const Tile tile = tiles.tile(t);
+            const int xa = max(tile.x0, 1);     // 内部のセルの範囲
+            const int xb = min(tile.x1, W - 1);
+
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                unsigned char* out = &mfd.weights[(size_t)y * W * 8];
+                float* smax = &mfd.slope[(size_t)y * W];
+
+                if (y == 0 || y == H - 1 || W < 3) {
+                    for (int x = tile.x0; x < tile.x1; ++x) borderCell(surface, y, x, W, H, c, out + (size_t)x * 8, smax + x);
+                    continue;
+                }
+
+                for (int x = xa; x < xb; ++x) smax[x] = 0.0f;
+
+                const double* rows[3] = { surface[y - 1].data(), surface[y].data(), surface[y + 1].data() };
+                const double* center = rows[1];
+
+                // 方向ごとにタイル1行分まとめて計算する（x が連続なのでベクトル化できる）
+                for (int d = 0; d < 8; ++d) {
+                    const double* nb = rows[1 + dyc[d]] + dxc[d];
+                    float* f = work.data() + (size_t)d * tiles.tileCols; // タイルの左端 xa から数えた位置で持つ
+                    const float inv = c.invDist[d];
+                    const float len = c.contour[d];
+#pragma omp simd
+                    for (int x = xa; x < xb; ++x) {
+                        float s = (float)(center[x] - nb[x]) * inv;
+                        s = (s > 0.0f) ? s : 0.0f;
+                        f[x - xa] = s;
+                        smax[x] = (s > smax[x]) ? s : smax[x];
+                    }
+                    if (c.usePow) {
+                        const float p = c.p;
+#pragma omp simd
+                        for (int x = 0; x < xb - xa; ++x) {
+                            f[x] = fastPow(f[x], p);
+                        }
+                    }
+#pragma omp simd
+                    for (int x = 0; x < xb - xa; ++x) {
+                        f[x] *= len;
+                    }
+                }
+
+                // セルごとに8方向をまとめて量子化
+                for (int x = xa; x < xb; ++x) {
+                    float f[8];
+                    for (int d = 0; d < 8; ++d) f[d] = work[(size_t)d * tiles.tileCols + (x - xa)];
+                    quantize(f, out + (size_t)x * 8);
+                }
+
+                if (tile.x0 == 0) borderCell(surface, y, 0, W, H, c, out, smax);
+                if (tile.x1 == W) borderCell(surface, y, W - 1, W, H, c, out + (size_t)(W - 1) * 8, smax + W - 1);
+            }
+        }
+    }
+}
@@ -0,0 +1,39 @@
+﻿#ifndef MFD_H
+#define MFD_H
+
+#include <vector>
+#include "tiling.h"
+
+using namespace std;
+
+// 流れの振り分け方
+enum class RoutingMode {
+    D8, // 最急方向の1セルにだけ流す
+    MFD // 下流側の複数のセルに分けて流す
+};
+
+// 多方向流の配分の決め方
+enum class MfdMethod {
+    Freeman, // Freeman (1991)：勾配^p に比例（p = 1.1）
+    Quinn    // Quinn et al. (1991)：勾配 × 等高線長に比例
+};
+
+// 多方向流の配分表
+// セルごとに8方向（dxc, dyc の順）の配分を 0..255 の整数で持つ（1セル8バイト, 合計255）
+struct MfdWeights {
+    int width = 0;
+    int height = 0;
+    MfdMethod method = MfdMethod::Freeman;
+    double exponent = 1.1;          // Freeman の指数
+    vector<unsigned char> weights;  // (y * width + x) * 8 + d
+    vector<float> slope;            // セルごとの最急勾配（流出量の計算用）
+    TileGrid tiles;                 // タイル分割（タイルごとにスレッドに分ける）
+};
+
+// 配分表の準備
+MfdWeights makeMfdWeights(int width, int height, MfdMethod method = MfdMethod::Freeman);
+
+// 水面から配分表を計算する（computeFlowDirection の代わり）
+void computeMfdWeights(const vector<vector<double>>& surface, MfdWeights& mfd);
+
+#endif // MFD_H
@@ -0,0 +1,74 @@
+﻿#include "output.h"
+#include <cmath>
+#include <algorithm>
+
+// 時刻 t の次の interval の倍数
+static double nextMultiple(double t, double interval, double eps) {
+    return (floor((t + eps) / interval) + 1.0) * interval;
+}
+
+// 時刻 t の直後に使う間隔
+static double intervalAfter(const OutputSchedule& s, double t, double eps, bool coarse) {
+    if (coarse) return s.coarseInterval;
+    double interval = s.coarseInterval;
+    for (const OutputTier& tier : s.tiers) {
+        interval = tier.interval;
+        if (t + eps < tier.until) break;
+    }
+    return interval;
+}
+
+// 保存するかを決める
+OutputReason updateOutput(OutputSchedule& s, double time, double dt, const MassLedger& ledger, bool coarse) {
+    const double eps = 0.5 * dt; // 時刻の丸めの誤差を吸収する
+    const double peak = ledger.maxDepth;
+    const double wet = ledger.wetArea;
+
+    // 最初のステップと、定常になった（変化し始めた）ときは、直前の時刻から次の保存の時刻を決め直す
+    if (!s.started || coarse != s.coarse) {
+        double t0 = time - dt;
+        s.nextTime = nextMultiple(t0, intervalAfter(s, t0, eps, coarse), eps);
+        s.coarse = coarse;
+    }
+    if (!s.started) {
+        s.lastPeak = s.prevPeak = peak;
+        s.lastWet = wet;
+        s.started = true;
+    }
+
+    // 閾値をまたいだことは毎ステップ調べ、最短の間隔より前なら保存できるまで覚えておく
+    for (double level : s.depthLevels) {
+        if ((s.prevPeak < level) != (peak < level)) s.crossed = true;
+    }
+    s.prevPeak = peak;
+
+    OutputReason reason = OutputReason::None;
+    if (time + eps >= s.nextTime) {
+        reason = coarse ? OutputReason::Coarse : OutputReason::Interval;
+        s.nextTime = nextMultiple(time, intervalAfter(s, time, eps, coarse), eps);
+    }
+    else if (!coarse && time - s.lastTime + eps >= s.minGap) {
+        if (s.crossed) reason = OutputReason::Threshold;
+        else if (s.peakChange > 0.0 && fabs(peak - s.lastPeak) >= s.peakChange) reason = OutputReason::PeakDepth;
+        else if (s.wetChange > 0.0 && fabs(wet - s.lastWet) >= s.wetChange * max(s.lastWet, 1.0)) reason = OutputReason::WetArea;
+    }
+
+    if (reason != OutputReason::None) {
+        s.crossed = false; // このコマに写っている
+        s.lastTime = time;
+        s.lastPeak = peak;
+        s.lastWet = wet;
+    }
+    return reason;
+}
+
+const char* outputReasonName(OutputReason reason) {
+    switch (reason) {
+    case OutputReason::Interval: return "定期";
+    case OutputReason::PeakDepth: return "最大水深の変化";
+    case OutputReason::Threshold: return "最大水深の閾値";
+    case OutputReason::WetArea: return "浸水面積の変化";
+    case OutputReason::Coarse: return "定常";
+    default: return "";
+    }
+}
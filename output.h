@@ -0,0 +1,59 @@
+﻿#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <vector>
+#include "massbalance.h"
+
+using namespace std;
+
+// 画像などを保存するタイミング
+// 決まった間隔（計算上の時刻で決める）に加えて、最大水深や浸水面積が大きく変わったとき・最大水深が閾値をまたいだときにも保存する
+// 判定には水収支の帳簿にソルバーのループの中で集計した値だけを使う（保存しないステップで全セルを回し直さない）
+
+// 保存の理由
+enum class OutputReason {
+    None,      // 保存しない
+    Interval,  // 決まった間隔
+    PeakDepth, // 最大水深が前回の保存から大きく変わった
+    Threshold, // 最大水深が閾値をまたいだ
+    WetArea,   // 浸水面積が前回の保存から大きく変わった
+    Coarse     // 定常になったあとの間隔（convergence.h）
+};
+
+// 時刻 until [s] までは interval [s] ごとに保存する
+struct OutputTier {
+    double until;
+    double interval;
+};
+
+struct OutputSchedule {
+    // 決まった間隔（DT = 0.1 秒なら 1000 ステップまで 50 ステップごと・以降 100 ステップごと）
+    // 間隔は粗くしておき、水が大きく動いたときのコマは出来事による保存で足す
+    vector<OutputTier> tiers = { { 100.0, 5.0 }, { 1e300, 10.0 } };
+    double coarseInterval = 50.0; // 定常になったあとの間隔 [s]
+
+    // 出来事による保存（0 なら使わない）
+    double peakChange = 0.25;                     // 最大水深の変化 [m]
+    double wetChange = 0.1;                       // 浸水面積の変化（前回の保存のときに対する割合）
+    vector<double> depthLevels = { 0.5, 1.0, 2.0 }; // 最大水深の閾値 [m]
+    double minGap = 1.0;                          // 出来事による保存の最短の間隔 [s]（その間に起きた出来事は間隔が空くまで持ち越す）
+
+    // 状態
+    double nextTime = 0.0;   // 次に決まった間隔で保存する時刻
+    double lastTime = -1e300; // 前回保存した時刻
+    double lastPeak = 0.0;   // 前回保存したときの最大水深
+    double lastWet = 0.0;    // 前回保存したときの浸水面積
+    double prevPeak = 0.0;   // 直前のステップの最大水深（閾値をまたいだかの判定用）
+    bool crossed = false;    // 前回の保存のあとに最大水深が閾値をまたいだか（保存するまで持ち越す）
+    bool coarse = false;     // 定常になったあとの間隔を使っているか
+    bool started = false;
+};
+
+// ステップの終わりに呼んで、保存するかを決める（time: ステップの終わりの時刻 [s], coarse: 定常になったあとか）
+// 保存すると決めたときは、そのときの最大水深・浸水面積を覚えておく
+OutputReason updateOutput(OutputSchedule& s, double time, double dt, const MassLedger& ledger, bool coarse = false);
+
+// 理由の名前（表示用）
+const char* outputReasonName(OutputReason reason);
+
+#endif // OUTPUT_H
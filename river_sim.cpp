@@ -7,6 +7,29 @@
 #include "WaterDepth_image.h"
 #include "mix_image.h"
 #include "simulate.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "inflow.h"
+#include "massbalance.h"
+#include "inertial.h"
+#include "mfd.h"
+#include "flowacc.h"
+#include "depression.h"
+#include "watershed.h"
+#include "streams.h"
+#include "channel.h"
+#include "voidfill.h"
+#include "cellflags.h"
+#include "terrain.h"
+#include "tiling.h"
+#include "bench_layout.h"
+#include "decomp.h"
+#include "distributed.h"
+#include "checkpoint.h"
+#include "initial.h"
+#include "ensemble.h"
+#include "convergence.h"
+#include "output.h"
 
 
 
@@ -20,7 +43,6 @@
 #include <chrono>
 #include "tinyxml2.h"  // TinyXML2
 #define PI 3.141592653589793
-std::vector<std::pair<int, int>> riverCells;// 川のセルの座標を記録
 
 const double w = 5.0; // 5mメッシュ（xmlから入手可能だ）
 
@@ -30,6 +52,56 @@ const double DEPTH = 0.05; // 初期水深 (m)
 
 const double DT = 0.1; // 1ステップ何秒であるか
 
+const SolverEngine ENGINE = SolverEngine::D8; // 計算エンジン（D8 / LocalInertial）
+
+const RoutingMode ROUTING = RoutingMode::D8; // D8エンジンの流し方（D8 / MFD）
+
+const bool RAIN = false; // 雨を降らせるか
+
+const bool INFILTRATION = false; // 浸透を計算するか（true にすると土壌に水が吸われ、貯留量と流出量が変わる）
+
+const InfiltrationModel INFIL_MODEL = InfiltrationModel::GreenAmpt; // 浸透モデル
+
+const unsigned char SOIL_CLASS = 2; // 全域の土壌クラス（2:ローム）
+
+const BoundaryType EDGE_BOUNDARY = BoundaryType::FreeOutflow; // 外周の境界条件
+
+const bool INFLOW = false; // 上流からの流入を入れるか
+
+const string INFLOW_FILE = "inflow.csv"; // 流入点の設定（名前,ハイドログラフ,緯度,経度[,緯度,経度]）
+
+const Bathymetry BATHYMETRY = Bathymetry::Constant; // 水域の河床（None / Constant / DistanceScaled）
+
+const double RIVER_DEPTH = 3.0; // 水域の水深 [m]
+
+const DepressionMethod DEPRESSION = DepressionMethod::Breach; // DEMの窪地の処理（None / Fill / Epsilon / Breach）
+
+const uint32_t SUBBASIN_CELLS = 2000; // 小流域に区切るセル数の目安
+
+const uint32_t STREAM_CELLS = 400; // 河道とみなす累積セル数（400セル = 1ha）
+
+const bool CHANNEL = false; // 川を1次元の河道（キネマティックウェーブ）として流すか
+
+const int MASS_REPORT = 500; // 水収支を表示する間隔（ステップ, 0なら表示しない）
+
+const int DOMAINS = 1; // 局所慣性近似を何個の小領域（スレッドのグループ）に分けて計算するか（1なら分けない, 河道とは併用できない）
+
+const bool DISTRIBUTED = false; // 局所慣性近似を MPI のランクに分けて計算するか（RIVER_SIM_USE_MPI を定義してビルドし mpirun で起動, 河道とは併用できない）
+
+const int CHECKPOINT = 1000; // チェックポイントを保存する間隔（ステップ, 0なら保存しない, 最後のステップでも保存する）
+
+const string CHECKPOINT_FILE = "checkpoint.bin"; // チェックポイントの保存先（river_sim --restart [ファイル] で続きから計算する）
+
+const InitialWater INITIAL_WATER = InitialWater::Uniform; // 初期水深（Uniform: 全域に DEPTH / Baseflow: 基底流の定常状態 / Snapshot: INITIAL_FILE から）
+
+const string INITIAL_FILE = "checkpoint.bin"; // Snapshot の読み込み元（チェックポイントか makeCsv の water.csv, 設定が違う計算のものでもよい）
+
+const int SPINUP = 0; // 本計算の前に雨なしで流しておくステップ数（画像と水収支は出さない）
+
+const SteadyAction STEADY_ACTION = SteadyAction::Stop; // 定常・水が抜けきったときの動作（None / Stop / CoarseOutput, 閾値は ConvergenceOptions）
+
+const double STEADY_SAVE = 50.0; // CoarseOutput のときの画像の保存間隔 [s]（定常になる前の間隔と出来事による保存は OutputSchedule）
+
 
 using namespace std;
 using namespace tinyxml2;
@@ -100,161 +172,142 @@ vector<vector<double>> loadElevations(const string& filename, int width) {
     return elevations;
 }
 
-// 水域データの処理(周りの平均)
-void fillMissingElevations(vector<vector<double>>& data, int width, int height) {
-    const double nodata = -9999.0;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-
-
-
-
-            if (data[y][x] == nodata) {
-                riverCells.emplace_back(y, x); // 川のセルを記録
-
-                double sum = 0.0;
-                int count = 0;
-
-                for (int dy = -1; dy <= 1; ++dy) {
-                    for (int dx = -1; dx <= 1; ++dx) {
-                        int ny = y + dy;
-                        int nx = x + dx;
-
-                        if (ny < 0 || ny >= height || nx < 0 || nx >= width) continue;
-                        if (ny == y && nx == x) continue;
-
-                        double neighbor = data[ny][nx];
-                        if (neighbor != nodata) {
-                            sum += neighbor;
-                            count++;
-                        }
-                    }
-                }
-
-                if (count > 0) {
-                    data[y][x] = sum / count;
-                }
-                else {
-                    data[y][x] = 0.0;  // 周囲にも有効データがない場合の代替値
-                }
-            }
-        }
-    }
-}
-
-
 //傾斜角を計算する関数
 vector<vector<double>> makeSlope(const vector<vector<double>>& data, int width, int height) {
     vector<vector<double>> slope(height, vector<double>(width, 0.0));// 傾斜角の配列（初期値は0.0）
 
     double dx = 5.0;  // 東西方向のピクセル間隔（m）
     double dy = 5.0;  // 南北方向のピクセル間隔 (m)
-    int ct = 0;
 
-    for (int i = 1; i < height - 1; ++i) {
-        for (int j = 1; j < width - 1; ++j) {
+    // タイルごとにスレッドに分ける（3行分の近傍がキャッシュに残る幅で進む）
+    TileGrid tiles = makeTileGrid(width, height, 2 * sizeof(double));
+    forEachTile(tiles, [&](const Tile& t) {
+        for (int i = max(t.y0, 1); i < min(t.y1, height - 1); ++i) {
+            for (int j = max(t.x0, 1); j < min(t.x1, width - 1); ++j) {
 
-            /*
-            //標高0が含まれる地点の処理
-            if (data[i - 1][j - 1] == 0.0 || data[i - 1][j] == 0.0 || data[i - 1][j + 1] == 0.0 ||
-                data[i][j - 1] == 0.0 || data[i][j] == 0.0 || data[i][j + 1] == 0.0 ||
-                data[i + 1][j - 1] == 0.0 || data[i + 1][j] == 0.0 || data[i + 1][j + 1] == 0.0) {// 9ピクセル内に0があるときは
+                /*
+                //標高0が含まれる地点の処理
+                if (data[i - 1][j - 1] == 0.0 || data[i - 1][j] == 0.0 || data[i - 1][j + 1] == 0.0 ||
+                    data[i][j - 1] == 0.0 || data[i][j] == 0.0 || data[i][j + 1] == 0.0 ||
+                    data[i + 1][j - 1] == 0.0 || data[i + 1][j] == 0.0 || data[i + 1][j + 1] == 0.0) {// 9ピクセル内に0があるときは
 
-                slope[i][j] = 0.0; // 傾斜を0として扱う
+                    slope[i][j] = 0.0; // 傾斜を0として扱う
 
-                continue;
-            }
-            */
+                    continue;
+                }
+                */
 
-            double dzdx = ((data[i - 1][j - 1] + 2 * data[i][j - 1] + data[i + 1][j - 1]) - (data[i - 1][j + 1] + 2 * data[i][j + 1] + data[i + 1][j + 1])) / (8.0 * dx);
-            double dzdy = ((data[i - 1][j - 1] + 2 * data[i - 1][j] + data[i - 1][j + 1]) - (data[i + 1][j - 1] + 2 * data[i + 1][j] + data[i + 1][j + 1])) / (8.0 * dy);
+                double dzdx = ((data[i - 1][j - 1] + 2 * data[i][j - 1] + data[i + 1][j - 1]) - (data[i - 1][j + 1] + 2 * data[i][j + 1] + data[i + 1][j + 1])) / (8.0 * dx);
+                double dzdy = ((data[i - 1][j - 1] + 2 * data[i - 1][j] + data[i - 1][j + 1]) - (data[i + 1][j - 1] + 2 * data[i + 1][j] + data[i + 1][j + 1])) / (8.0 * dy);
 
-            double slope_rad = atan(sqrt(dzdx * dzdx + dzdy * dzdy));
-            double slope_deg = slope_rad * 57.29578;  // ラジアン→度
+                double slope_rad = atan(sqrt(dzdx * dzdx + dzdy * dzdy));
+                double slope_deg = slope_rad * 57.29578;  // ラジアン→度
 
-            if (slope_deg == 0.0) { // 傾斜0のとき
-                //slope_deg = 1.0; // 試しに
-                ct += 1;
+                slope[i][j] = slope_deg; // データを格納
             }
-            slope[i][j] = slope_deg; // データを格納
         }
-    }
-    //cout << "slope_0:" << ct << "\n";
+    });
     return slope;
 }
 
-// 方位角を計算する関数
-vector<vector<double>> makeAspect(const vector<vector<double>>& data, int width, int height) {
-    vector<vector<double>> aspect(height, vector<double>(width, 0.0));// 方位角の配列（初期値は0.0）
-
-    double dx = 5.0;  // 東西方向のピクセル間隔（m）
-    double dy = 5.0;  // 南北方向のピクセル間隔 (m)
-
-
-    for (int i = 1; i < height - 1; ++i) {
-        for (int j = 1; j < width - 1; ++j) {
-
-            /*
-            //標高0が含まれる地点の処理
-            if (data[i - 1][j - 1] == 0.0 || data[i - 1][j] == 0.0 || data[i - 1][j + 1] == 0.0 ||
-                data[i][j - 1] == 0.0 || data[i][j] == 0.0 || data[i][j + 1] == 0.0 ||
-                data[i + 1][j - 1] == 0.0 || data[i + 1][j] == 0.0 || data[i + 1][j + 1] == 0.0) {// 9ピクセル内に0があるときは
-
-                aspect[i][j] = 360; // どうにかする（川のある地点の方位角をどう扱うか迷う）
-                continue;
-            }
-            */
-
-            double zx = ((data[i - 1][j + 1] + 2 * data[i][j + 1] + data[i + 1][j + 1]) -
-                (data[i - 1][j - 1] + 2 * data[i][j - 1] + data[i + 1][j - 1])) / (8.0 * dx);
-
-            double zy = ((data[i - 1][j - 1] + 2 * data[i - 1][j] + data[i - 1][j + 1]) -
-                (data[i + 1][j - 1] + 2 * data[i + 1][j] + data[i + 1][j + 1])) / (8.0 * dy);
-
-            double A = atan2(-zy, -zx) * 180.0 / PI;// 傾きと逆向きを正
-            if (A < 0) A += 360.0;
-
-            aspect[i][j] = A;// データを格納
-        }
-    }
-
-    return aspect;
-}
-
 // D8の方向オフセット（右回り：E, SE, S, SW, W, NW, N, NE）
 const int dxc[8] = { 1, 1, 0, -1, -1, -1,  0, 1 };
 const int dyc[8] = { 0, 1, 1,  1,  0, -1, -1, -1 };
 const int dirCode[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };// D8方向コード
 
+// 1セルの流出方向（D8法, 8近傍で最も低い方向のコード, なければ 0）
+static inline int d8Direction(const vector<vector<double>>& dem, int x, int y, int width, int height) {
+    double centerElev = dem[y][x];
+    double minElev = centerElev;
+    int minDir = 0;
+    bool border = (y == 0 || y == height - 1 || x == 0 || x == width - 1); // 外周のセル
+
+    // 8方向の隣接セルをチェック
+    for (int d = 0; d < 8; ++d) {
+        int nx = x + dxc[d];
+        int ny = y + dyc[d];
+        if (border && (nx < 0 || nx >= width || ny < 0 || ny >= height)) continue; // 領域外は見ない
+        double neighborElev = dem[ny][nx];
+
+        if (neighborElev < minElev) {
+            minElev = neighborElev;
+            minDir = dirCode[d];  // 最も低い方向のコードを記録
+        }
+    }
+    return minDir;
+}
+
 // 流出方向（D8法）
 vector<vector<int>> computeFlowDirection(const vector<vector<double>>& dem, int width, int height) {
     vector<vector<int>> flowDir(height, vector<int>(width, 0));
 
-    for (int y = 1; y < height - 1; ++y) {
-        for (int x = 1; x < width - 1; ++x) {
-            double centerElev = dem[y][x];
-            double minElev = centerElev;
-            int minDir = 0;
-
-            // 8方向の隣接セルをチェック
-            for (int d = 0; d < 8; ++d) {
-                int nx = x + dxc[d];
-                int ny = y + dyc[d];
-                double neighborElev = dem[ny][nx];
-
-                if (neighborElev < minElev) {
-                    minElev = neighborElev;
-                    minDir = dirCode[d];  // 最も低い方向のコードを記録
-                }
+    // タイルごとにスレッドに分ける（書き込むのは自分のタイルのセルだけ）
+    TileGrid tiles = makeTileGrid(width, height, sizeof(double) + sizeof(int));
+    forEachTile(tiles, [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                flowDir[y][x] = d8Direction(dem, x, y, width, height);  // 流向を記録（1,2,...,128 or 0）
             }
+        }
+    });
 
-            flowDir[y][x] = minDir;  // 流向を記録（1,2,...,128 or 0）
+    return flowDir;
+
+}
+
+// 流出方向を水面が変わったところだけ計算し直す（戻り値は計算し直したセル数）
+// 流向はそのセルと8近傍の水面だけで決まるので、3x3 の中に CELL_DIRTY（前のステップで水深が変わった）のセルがあるセルだけ計算する
+// 水の動かない行は CELL_DIRTY の有無を見るだけで飛ばす。最後に CELL_DIRTY を消す
+size_t updateFlowDirection(const vector<vector<double>>& surface, vector<vector<int>>& flowDir, CellFlags& flags, int width, int height) {
+    // 行ごとに CELL_DIRTY のセルがあるか（rowDirty[y + 1], 上下の外側は 0）
+    vector<unsigned char> rowDirty(height + 2, 0);
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* b = &flags.bits[(size_t)y * width];
+        uint8_t any = 0;
+#pragma omp simd reduction(|:any)
+        for (int x = 0; x < width; ++x) {
+            any |= b[x];
         }
+        rowDirty[y + 1] = (any & CELL_DIRTY) ? 1 : 0;
     }
 
-    return flowDir;
+    TileGrid tiles = makeTileGrid(width, height, sizeof(double) + sizeof(int) + 1);
+    vector<size_t> count(tiles.count(), 0);
+    forEachTile(tiles, [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            if (!rowDirty[y] && !rowDirty[y + 1] && !rowDirty[y + 2]) continue; // 上下の行も含めて変化なし
+
+            const int ya = max(y - 1, 0);
+            const int yb = min(y + 1, height - 1);
+            for (int x = t.x0; x < t.x1; ++x) {
+                const int xa = max(x - 1, 0);
+                const int xb = min(x + 1, width - 1);
+                bool dirty = false;
+                for (int ny = ya; ny <= yb && !dirty; ++ny) {
+                    for (int nx = xa; nx <= xb; ++nx) {
+                        if (flags.has((size_t)ny * width + nx, CELL_DIRTY)) {
+                            dirty = true;
+                            break;
+                        }
+                    }
+                }
+                if (!dirty) continue;
+
+                flowDir[y][x] = d8Direction(surface, x, y, width, height);
+                count[t.index]++;
+            }
+        }
+    });
+
+    for (int y = 0; y < height; ++y) {
+        if (!rowDirty[y + 1]) continue;
+        uint8_t* b = &flags.bits[(size_t)y * width];
+        for (int x = 0; x < width; ++x) b[x] &= (uint8_t)~CELL_DIRTY;
+    }
 
+    size_t total = 0;
+    for (size_t c : count) total += c;
+    return total;
 }
 // 水を配置***************************************************************************************************************************
 vector<vector<double>> WaterDepth(int width, int height, double depth = DEPTH) {
@@ -314,7 +367,13 @@ void saveWaterDemImage(const vector<vector<double>>& surface, const string& file
 }
 */
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    // MPI（DISTRIBUTED のとき, 表示と保存はランク 0 だけ）
+    int rank = 0, ranks = 1;
+    initDistributed(&argc, &argv, rank, ranks);
+    const bool root = (rank == 0);
+    if (!root) cout.setstate(ios_base::failbit);
 
     int c = 0;
     string xmlFile = "FG-GML-5438-01-14-DEM5A-20180226.xml";
@@ -325,40 +384,87 @@ int main() {
 
     int height = data.size();//データの行数を取得
 
-    // 水域処理
-    fillMissingElevations(data, width, height);
-
-    // 川の部分を3m下げる（記録されたセルだけ）
-    for (const auto& cell : riverCells) {
-        int y = cell.first;
-        int x = cell.second;
-        data[y][x] -= 3.0;
+    // 水域処理（欠損値を周りから補間し、河床を下げる）
+    VoidFillOptions voidOpt;
+    voidOpt.bathymetry = BATHYMETRY;
+    voidOpt.depth = RIVER_DEPTH;
+    CellFlags flags = makeCellFlags(width, height); // セルの種類（水域・河道・外周・窪地・乾燥）
+    size_t voidCells = fillVoids(data, width, height, voidOpt, &flags); // 水域のセルに CELL_WATERBODY を付ける
+    cout << "水域セル: " << voidCells << "（" << flags.waterBodies << "か所）\n";
+
+    // 窪地の処理（DEMの誤差の窪みに水が閉じ込められないように）
+    if (DEPRESSION != DepressionMethod::None) {
+        DepressionOptions dep;
+        dep.method = DEPRESSION;
+        DepressionStats ds = fillDepressions(data, width, height, dep);
+        cout << "窪地処理: 埋めたセル " << ds.raised << "（" << ds.fillVolume << "m3）, 掘ったセル " << ds.carved << "（" << ds.cutVolume << "m3）\n";
     }
 
-    // 傾斜データ
-    vector<vector<double>> slope = makeSlope(data, width, height);
-
-    // 方位データ
-    vector<vector<double>> aspect = makeAspect(data, width, height);
+    // --bench-layout [size]：グリッドの並べ方の比較だけして終わる
+    if (argc > 1 && string(argv[1]) == "--bench-layout") {
+        int size = (argc > 2) ? atoi(argv[2]) : 2048;
+        if (root) benchLayouts(data, width, height, size);
+        finalizeDistributed();
+        return 0;
+    }
 
     // 流出方向
     vector<vector<int>> flowDir = computeFlowDirection(data, width, height);
+    size_t flats = resolveFlats(data, flowDir, width, height); // 平坦地にも流向を付ける
+    cout << "平坦地の流向: " << flats << "セル\n";
+    markSinks(flags, flowDir);
+    cout << "窪地セル: " << countFlags(flags, CELL_SINK) << "\n";
+
+    // 流量累積（地形の流向から上流のセル数を数える, 河道の抽出や観測点を選ぶ用）
+    FlowAccumulation flowAcc = computeFlowAccumulation(flowDir, width, height);
+    if (root) saveFlowAccumulationImage(flowAcc, "image/flowacc_output.png");
+
+    // 地形量（傾斜・方位・陰影・曲率・TWI を3x3の近傍を1回読むだけでまとめて計算）
+    TerrainProducts terrain = computeTerrain(data, width, height, &flowAcc);
+    const vector<float>& slope = terrain.slope;
+    const vector<float>& aspect = terrain.aspect;
+
+    // 初期水深
+    vector<vector<double>> water;
+    BaseflowOptions base;
+    base.minCells = STREAM_CELLS;
+    if (INITIAL_WATER == InitialWater::Baseflow) {
+        water = baseflowDepth(data, flowAcc, slope, flags, base); // 基底流の定常状態（流量は下の baseflowRecharge で保つ）
+    }
+    else if (INITIAL_WATER == InitialWater::Snapshot) {
+        if (!loadInitialWater(INITIAL_FILE, width, height, water)) { // 前の計算の水深
+            finalizeDistributed();
+            return 1;
+        }
+    }
+    else {
+        water = WaterDepth(width, height); // 全域に5cmの水を置く
+    }
+    if (INITIAL_WATER != InitialWater::Uniform) {
+        double volume = 0.0;
+        for (const auto& row : water) {
+            for (double h : row) volume += h;
+        }
+        cout << "初期水量: " << volume * w * w << "m3\n";
+    }
 
-    // 全域に5cmの水を置く
-    vector<vector<double>> water = WaterDepth(width, height);
+    // 浸透の準備（川のセルは水域として浸透させない）
+    InfiltrationState infil = makeInfiltration(width, height, INFIL_MODEL, SOIL_CLASS);
+    //loadSoilClasses("soil.csv", infil); // セルごとの土壌クラスを読む場合
+    for (size_t i = 0; i < flags.bits.size(); ++i) {
+        if (flags.has(i, CELL_WATERBODY)) infil.soilClass[i] = 0;
+    }
 
     
     // 標高画像生成
-    if (!data.empty()) {
+    if (root && !data.empty()) {
 
         // 最小・最大標高を調べる
         double minHeight = data[0][0], maxHeight = data[0][0];
         for (const auto& row : data) {
             for (double h : row) {
-                if (h != 0) {// 0はスキップ（グレースケールの時に都合が悪いため）
-                    if (h < minHeight) minHeight = h;
-                    if (h > maxHeight) maxHeight = h;
-                }
+                if (h < minHeight) minHeight = h;
+                if (h > maxHeight) maxHeight = h;
             }
         }cout << "max:" << maxHeight << "min:" << minHeight << endl;
         // 標高をグレースケール値に変換
@@ -386,14 +492,14 @@ int main() {
     }
 
     //傾斜画像生成
-    if (!slope.empty()) {
+    if (root && !slope.empty()) {
         vector<unsigned char> slopeImage(width * height);
 
         // 最小・最大傾斜を調べる
-        double min = slope[1][1], max = slope[1][1];
+        double min = slope[(size_t)width + 1], max = slope[(size_t)width + 1];
         for (int y = 1; y < height - 1; ++y) {
             for (int x = 1; x < width - 1; ++x) {
-                double h = slope[y][x];
+                double h = slope[(size_t)y * width + x];
                 if (h < min) min = h;
                 if (h > max) max = h;
             }
@@ -405,7 +511,7 @@ int main() {
         //グレースケール変換
         for (int y = 0; y < height; ++y) {
             for (int x = 0; x < width; ++x) {
-                double angle = slope[y][x];
+                double angle = slope[(size_t)y * width + x];
 
                 if (angle < 0) angle = 0;// (不要)
                 if (angle > 90) angle = 90;// (いらない)
@@ -423,16 +529,14 @@ int main() {
     }
 
     //方位画像生成
-    if (!aspect.empty()) {
+    if (root && !aspect.empty()) {
         vector<unsigned char> aspectImage(width * height);
 
         // 最小・最大方位を調べる
-        double min = aspect[1][1], max = aspect[1][1];
-        for (const auto& row : aspect) {
-            for (double h : row) {
-                if (h < min) min = h;
-                if (h > max) max = h;
-            }
+        double min = aspect[(size_t)width + 1], max = aspect[(size_t)width + 1];
+        for (float h : aspect) {
+            if (h < min) min = h;
+            if (h > max) max = h;
         }cout << "max:" << max << "min:" << min << "\n";
 
 
@@ -440,7 +544,7 @@ int main() {
         // グレースケール変換
         for (int y = 0; y < height; ++y) {
             for (int x = 0; x < width; ++x) {
-                double angle = aspect[y][x];// 1ピクセルずつ取り出す
+                double angle = aspect[(size_t)y * width + x];// 1ピクセルずつ取り出す
 
                 unsigned char gray = static_cast<unsigned char>((1.0 - angle / 360.0) * 255.0);// 正規化してグレースケール変換
                 aspectImage[y * width + x] = gray;// 格納
@@ -455,6 +559,35 @@ int main() {
         }
     }
 
+    // 陰影・曲率・TWI の画像
+    if (root) saveTerrainImages(terrain, "image/");
+
+    // 小流域への分割（合流するまで互いに独立なので、forEachSubBasin で別々のスレッドに割り当てられる）
+    Watershed watershed = delineateWatersheds(flowAcc, SUBBASIN_CELLS);
+    uint32_t maxLevel = 0;
+    for (uint32_t lv : watershed.level) maxLevel = max(maxLevel, lv);
+    cout << "小流域: " << watershed.count() << "個（最大段数 " << maxLevel << "）\n";
+
+    // 小流域ごとの上流の全セル数（上流から順にスレッドで集計し、出口の流量累積と照らし合わせる）
+    size_t basinMismatch = accumulateSubBasins(watershed, flowAcc);
+    if (basinMismatch > 0) {
+        cerr << "小流域の集計が流量累積と一致しません: " << basinMismatch << "個\n";
+    }
+    if (root) {
+        saveWatershedImage(watershed, "image/subbasin_output.png");
+        saveWatershedCsv(watershed, "subbasins.csv");
+    }
+
+    // 河道網（川のセルと累積セル数から区間・合流点・次数を作る）
+    StreamNetwork streams = extractStreams(flowAcc, data, flags, STREAM_CELLS);
+    unsigned char maxOrder = 0;
+    for (unsigned char o : streams.order) maxOrder = max(maxOrder, o);
+    cout << "河道網: " << streams.reaches() << "区間, 合流点 " << streams.junctions.size() << ", 最大次数 " << (int)maxOrder << "\n";
+    if (root) {
+        saveStreamImage(streams, "image/stream_output.png");
+        saveStreamCsv(streams, "streams.csv");
+    }
+
 
     
 
@@ -466,23 +599,244 @@ int main() {
 
     double rainfall_mm_per_hour = 50.0;     // 毎時
     double rainfall_rate = rainfall_mm_per_hour / 1000.0; // m/h に変換
-    double dt = 0.2; // 秒（ステップの時間と一致させる）
+    double dt = DT; // 秒（ステップの時間と一致させる）
     // ↓ 秒単位の雨量に変換
     double rainfall_per_step = rainfall_rate * (dt / 3600.0); // m/step
 
+    // 雨と浸透は simulateWaterFlow の中で流出と一緒に計算する
+    FlowOptions opts;
+    opts.rainfall = RAIN ? rainfall_per_step : 0.0;
+    opts.infil = INFILTRATION ? &infil : nullptr;
+    opts.flags = &flags;
+
+    // 外周の境界条件（辺ごとに変える場合は boundary.edge[EDGE_NORTH] などを書き換える）
+    BoundaryConfig boundary;
+    boundary.setAll(EDGE_BOUNDARY);
+    BoundaryFlux bflux;
+    opts.boundary = &boundary;
+    opts.bflux = &bflux;
+
+    // --ensemble [ファイル]：ここまでの地形の前処理を共有して、シナリオをまとめて計算して終わる
+    if (argc > 1 && string(argv[1]) == "--ensemble") {
+        if (root) {
+            string file = "scenarios.csv";
+            EnsembleSetup es;
+            for (int i = 2; i < argc; ++i) {
+                if (string(argv[i]) == "--batch") es.batch = true; // 局所慣性近似のシナリオをまとめて計算する
+                else file = argv[i];
+            }
+            vector<Scenario> scenarios = loadScenarios(file);
+            es.dem = &data;
+            es.width = width;
+            es.height = height;
+            es.flags = &flags;
+            es.infil = INFILTRATION ? &infil : nullptr;
+            es.boundary = &boundary;
+            es.engine = ENGINE;
+            es.routing = ROUTING;
+            cout << "アンサンブル: " << scenarios.size() << "シナリオ\n";
+            vector<ScenarioResult> results = runEnsemble(scenarios, es);
+            saveEnsembleCsv(results, "ensemble_result.csv");
+        }
+        finalizeDistributed();
+        return 0;
+    }
+
+    // 上流からの流入点（位置は緯度経度で指定し、このタイルのセルに直す）
+    vector<InflowSource> inflows;
+    GridGeoref geo;
+    if (INFLOW && loadGridGeoref(xmlFile, geo)) {
+        inflows = loadInflowSources(INFLOW_FILE, geo);
+    }
+    if (INITIAL_WATER == InitialWater::Baseflow) {
+        inflows.push_back(baseflowRecharge(flowAcc, base)); // 川のセルに基底流の分を流し続ける
+    }
+    if (!inflows.empty()) opts.inflows = &inflows;
+
+    // 水収支の帳簿（simulateWaterFlow のループの中で集計する）
+    MassLedger ledger;
+    ledger.interval = MASS_REPORT;
+    opts.ledger = &ledger;
+
+    // 局所慣性近似の状態（面の流量を持ち越す）
+    InertialState inertial;
+    DomainDecomposition decomp;
+    DistributedDomain dist;
+    const bool distributed = (ENGINE == SolverEngine::LocalInertial && DISTRIBUTED && !CHANNEL);
+    const bool decomposed = (ENGINE == SolverEngine::LocalInertial && DOMAINS > 1 && !CHANNEL && !distributed);
+    if (distributed) {
+        dist = makeDistributed(data, width, height, rank, ranks);
+        loadDistributed(dist, water, &flags, opts.infil); // 計算中は自分の帯の水深・フラグ・浸透の状態だけを使う
+        cout << "ランク: " << ranks << "個\n";
+
+        // ランク 0 以外は全体の配列を捨てる（画像を作るランク 0 だけが全体を持ち、保存の前に帯を集める）
+        // 地形の前処理はどのランクも全体で行ったので、ここまでのメモリはランク数で減らない
+        if (!root) {
+            data = vector<vector<double>>();
+            water = vector<vector<double>>();
+            flags = CellFlags();
+            infil = InfiltrationState();
+            flowDir = vector<vector<int>>();
+            flowAcc = FlowAccumulation();
+            terrain = TerrainProducts();
+            watershed = Watershed();
+            streams = StreamNetwork();
+        }
+    }
+    else if (decomposed) {
+        decomp = makeDecomposition(data, width, height, DOMAINS); // 小領域ごとに受け持つグループが配列を確保する
+        cout << "領域分割: " << decomp.parts.size() << "個\n";
+    }
+    else if (ENGINE == SolverEngine::LocalInertial) {
+        inertial = makeInertial(data, width, height);
+    }
+
+    // 多方向流の配分表（毎ステップ水面から作り直す）
+    MfdWeights mfd;
+    if (ROUTING == RoutingMode::MFD) {
+        mfd = makeMfdWeights(width, height, MfdMethod::Freeman);
+        opts.mfd = &mfd;
+    }
+
+    // 1次元の河道（川のセルは河道網の順に大きな時間刻みで流し、岸を超えたときだけ氾濫原とやり取りする）
+    ChannelState channel;
+    if (CHANNEL) {
+        channel = makeChannel(streams, flowAcc, data, flags);
+        opts.channel = &channel;
+        cout << "河道セル: " << channel.cells.size() << "（" << channel.interval * DT << "秒ごと）\n";
+    }
+
+    // チェックポイント（MPI のときはランクごとに別のファイル）
+    CheckpointConfig ckConfig;
+    ckConfig.width = width;
+    ckConfig.height = height;
+    ckConfig.cellSize = w;
+    ckConfig.dt = DT;
+    ckConfig.engine = (int)ENGINE;
+    ckConfig.routing = (int)ROUTING;
+    ckConfig.rainfall = opts.rainfall;
+    ckConfig.domains = decomposed ? (int)decomp.parts.size() : 1;
+    ckConfig.rank = rank;
+    ckConfig.ranks = distributed ? ranks : 1;
+    CheckpointState ckState;
+    ckState.water = distributed ? nullptr : &water; // MPI のときは帯の状態を DIST に保存する
+    ckState.flags = distributed ? nullptr : &flags;
+    ckState.infil = distributed ? nullptr : opts.infil;
+    ckState.bflux = &bflux;
+    ckState.ledger = &ledger;
+    ckState.inflows = inflows.empty() ? nullptr : &inflows;
+    ckState.inertial = (ENGINE == SolverEngine::LocalInertial && !distributed && !decomposed) ? &inertial : nullptr;
+    ckState.decomp = decomposed ? &decomp : nullptr;
+    ckState.dist = distributed ? &dist : nullptr;
+    ckState.channel = CHANNEL ? &channel : nullptr;
+    ConvergenceMonitor monitor; // 収束の判定（水収支の帳簿の値で判定する）
+    OutputSchedule schedule;    // 画像を保存するタイミング（計算上の時刻と、最大水深・浸水面積の変化で決める）
+    schedule.coarseInterval = STEADY_SAVE;
+    ckState.monitor = &monitor;
+    const string rankSuffix = (distributed && ranks > 1) ? "." + to_string(rank) : "";
+    CheckpointWriter ckWriter;
+    ckWriter.path = CHECKPOINT_FILE + rankSuffix;
+
+    // --restart [ファイル]：チェックポイントの続きから計算する
+    int firstStep = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) != "--restart") continue;
+        string file = (i + 1 < argc) ? argv[i + 1] : CHECKPOINT_FILE;
+        double time = 0.0;
+        if (!loadCheckpoint(file + rankSuffix, ckConfig, firstStep, time, ckState)) {
+            finalizeDistributed();
+            return 1;
+        }
+        cout << "再開: " << firstStep << "ステップ目（" << time << "秒）から\n";
+    }
+
+    // 小領域・ランクの帯が持っている水深などを全体の配列に集める（画像とチェックポイントの前に呼ぶ）
+    auto collect = [&]() {
+        if (distributed) gatherWater(dist, water, &flags); // 各ランクの帯をランク 0 に集める
+        if (decomposed) storeDecomposition(decomp, water, &flags, opts.infil);
+    };
+
+    // D8の流出方向（前のステップの流向を持ち越し、水面が変わったセルの近くだけ計算し直す）
+    vector<vector<int>> waterDir;
+    size_t dirCells = 0; // 直前のステップで流向を計算したセル数
+
+    // 1ステップ進める（opts.time はその前に設定する）
+    auto advance = [&]() {
+        if (ENGINE == SolverEngine::LocalInertial) {
+            // 局所慣性近似（面の流量で計算するので流出方向はいらない）
+            if (distributed) {
+                simulateDistributed(water, dist, DT, 0.03, opts);
+            }
+            else if (decomposed) {
+                simulateDecomposed(water, decomp, DT, 0.03, opts);
+            }
+            else {
+                simulateLocalInertial(water, inertial, width, height, DT, 0.03, opts);
+            }
+        }
+        else {
+            //更新処理
+            vector<vector<double>> surface = TotalHeight(data, water, width, height); // totalHeight
+            vector<vector<double>> wa_slope = makeSlope(surface, width, height); // 更新傾斜
+
+            // 流出方向（多方向流のときは配分表）
+            if (ROUTING == RoutingMode::MFD) {
+                computeMfdWeights(surface, mfd);
+            }
+            else if (waterDir.empty()) {
+                waterDir = computeFlowDirection(surface, width, height);
+                dirCells = (size_t)width * height;
+            }
+            else {
+                dirCells = updateFlowDirection(surface, waterDir, flags, width, height); // 前のステップで水面が変わったところだけ
+            }
+
+            // 最小・最大傾斜を調べる
+            double min = wa_slope[1][1], max = wa_slope[1][1];
+            for (int y = 1; y < height - 1; ++y) {
+                for (int x = 1; x < width - 1; ++x) {
+                    double h = wa_slope[y][x];
+                    if (h < min) min = h;
+                    if (h > max) max = h;
+                }
+            }
+            //cout << t + 1 << ":maxslope:" << max << " minslope:" << min << endl;
+
+            simulateWaterFlow(water, waterDir, surface, width, height, DT, 0.03, opts);// simulation**************************************
+        }
+    };
+
+    // スピンアップ（雨なし・流入は最初の流量のままで SPINUP ステップ流してから本計算を始める）
+    // 水深と浸透の累積（土の湿り具合）は持ち越し、水収支と流出量の累計は0に戻す
+    if (SPINUP > 0 && firstStep == 0) {
+        const double rain = opts.rainfall;
+        opts.rainfall = 0.0;
+        opts.time = 0.0;
+        for (int s = 0; s < SPINUP; ++s) {
+            advance();
+        }
+        opts.rainfall = rain;
+
+        ledger = MassLedger();
+        ledger.interval = MASS_REPORT;
+        bflux = BoundaryFlux();
+        for (auto& src : inflows) {
+            src.stepVolume = 0.0;
+            src.totalVolume = 0.0;
+        }
+        channel.outVolume = 0.0;
+        channel.totalOut = 0.0;
+        channel.spillVolume = 0.0;
+        collect(); // 最初の画像用
+        cout << "スピンアップ: " << SPINUP << "ステップ\n";
+    }
+
     // シミュレーション**********************************************************************************
     int steps = STEP;// ステップの数
-    for (int t = 0; t < steps; ++t) {
-
-        ////雨を追加
-        //for (int y = 0; y < height; ++y) {
-        //    for (int x = 0; x < width; ++x) {
-        //        water[y][x] += rainfall_per_step;
-        //    }
-        //}
+    for (int t = firstStep; t < steps; ++t) {
 
         
-        if (t == 0) {
+        if (t == 0 && root) {
             // 水深高画像
             //string filename1 = "image/water_step_" + to_string(t + 1) + ".png";
             ostringstream oss;
@@ -497,46 +851,32 @@ int main() {
         
 
 
-        //更新処理
-        vector<vector<double>> surface = TotalHeight(data, water, width, height); // totalHeight
-        vector<vector<double>> wa_slope = makeSlope(surface, width, height); // 更新傾斜
-
-        // 流出方向
-        vector<vector<int>> waterDir = computeFlowDirection(surface, width, height);
-
-        // 最小・最大傾斜を調べる
-        double min = wa_slope[1][1], max = wa_slope[1][1];
-        for (int y = 1; y < height - 1; ++y) {
-            for (int x = 1; x < width - 1; ++x) {
-                double h = wa_slope[y][x];
-                if (h < min) min = h;
-                if (h > max) max = h;
-            }
-        }
-        //cout << t + 1 << ":maxslope:" << max << " minslope:" << min << endl;
-
-        double totalWater = 0.0;
-        for (const auto& row : water)
-            for (double d : row) totalWater += d;
-        //cout << "Total water: " << totalWater << " m\n";
+        opts.time = t * DT;
 
-        simulateWaterFlow(water, waterDir, surface, width, height, DT);// simulation**************************************
+        advance();
 
         
         int step = t + 1;
-        bool save = false;
-
-        if (step <= 400) {
-            save = (step % 10 == 0);
-        }
-        else if (step <= 1000) {
-            save = (step % 25 == 0);
-        }
-        else {
-            save = (step % 50 == 0);
+        reportMassBalance(ledger, step);
+
+        // 収束の判定（定常・水が抜けきったら終えるか、画像の保存を減らす）
+        RunPhase lastPhase = monitor.phase;
+        RunPhase phase = updateConvergence(monitor, ledger);
+        if (phase != lastPhase && STEADY_ACTION != SteadyAction::None) {
+            cout << "[" << step << "] " << runPhaseName(phase) << "（最大水深変化 " << ledger.maxChange << "m, 貯留量の変化 " << monitor.storageRate
+                 << ", 浸水面積 " << ledger.wetArea << "m2）\n";
         }
+        const bool settled = (phase != RunPhase::Running);
+        const bool stop = settled && STEADY_ACTION == SteadyAction::Stop;
+
+        // 保存するか（決まった時刻と、最大水深・浸水面積が大きく変わったとき）
+        OutputReason reason = updateOutput(schedule, step * DT, DT, ledger, settled && STEADY_ACTION == SteadyAction::CoarseOutput);
+        bool save = stop || reason != OutputReason::None; // 終えるときは最後の状態を保存する
 
-        if (save) {
+        const bool checkpoint = CHECKPOINT > 0 && (step % CHECKPOINT == 0 || step == steps || stop);
+        if (save || (checkpoint && decomposed)) collect();
+
+        if (save && root) {
             // ===== 保存処理 =====
 
             ostringstream oss;
@@ -544,14 +884,43 @@ int main() {
             string filename1 = oss.str();
             saveWaterDepthAsImage(water, filename1);
 
+            if (reason != OutputReason::None && reason != OutputReason::Interval) {
+                cout << "保存（" << outputReasonName(reason) << "）: " << step * DT << "秒, 最大水深 " << ledger.maxDepth << "m\n";
+            }
+
+            // 領域外への流出量
+            cout << "境界流出: " << bflux.stepVolume() / DT << "m3/s (累積 " << bflux.totalVolume() << "m3)\n";
+            cout << "浸水面積: " << ledger.wetArea << "m2\n";
+            if (ENGINE == SolverEngine::D8 && ROUTING == RoutingMode::D8) {
+                cout << "流向の再計算: " << dirCells << "セル\n";
+            }
+            if (CHANNEL) {
+                cout << "河道流出: " << channel.outRate << "m3/s (累積 " << channel.totalOut << "m3, 氾濫 " << channel.spillVolume << "m3)\n";
+            }
+            for (const auto& src : inflows) {
+                cout << "流入 " << src.name << ": " << src.stepVolume / DT << "m3/s (累積 " << src.totalVolume << "m3)\n";
+            }
+
             string filename2 = "image2/mix_step_" + to_string(step) + ".png";
             //MixImage("image/dem_output.png", filename1, filename2);
         }
+
+        // チェックポイント（書き出しは別スレッドなので、次のステップの計算と重なる）
+        if (checkpoint) {
+            saveCheckpoint(ckWriter, ckConfig, step, step * DT, ckState);
+        }
+
+        if (stop) {
+            cout << "計算を終了: " << step << "ステップ（" << step * DT << "秒）\n";
+            break;
+        }
         
 
 
     }
 
+    finishCheckpoint(ckWriter);
+
     // 終了時刻
     auto end = std::chrono::high_resolution_clock::now();
 
@@ -559,6 +928,8 @@ int main() {
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "実行時間: " << elapsed.count() << " 秒" << std::endl;
 
+    finalizeDistributed();
+
 
     //makeCsv(water); //水深だね
 
@@ -570,7 +941,7 @@ int main() {
     }
     for (size_t i = 0; i < data.size(); i++) {
         for (size_t j = 0; j < data[i].size(); j++) {
-            file << slope[i][j] << "\n";
+            file << slope[i * width + j] << "\n";
 
         }
     }
@@ -1,75 +1,202 @@
 #include "simulate.h"
+#include "infiltration.h"
+#include "boundary.h"
+#include "inflow.h"
+#include "massbalance.h"
+#include "mfd.h"
+#include "channel.h"
+#include "cellflags.h"
+#include "tiling.h"
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 
 // V~[V
-void simulateWaterFlow(vector<vector<double>>& water, const vector<vector<int>>& flowDir, const vector<vector<double>>& surface, int width, int height, double DT, double n) { // n͑exW, dt1XebvƂ̎ԕωH
+void simulateWaterFlow(vector<vector<double>>& water, const vector<vector<int>>& flowDir, const vector<vector<double>>& surface, int width, int height, double DT, double n, const FlowOptions& opts) { // n͑exW, dt1XebvƂ̎ԕωH
     // ꎞIȍXVp}bviVʂĂj
     vector<vector<double>> nextWater = water; // XV邽߂̔z
 
-    int ss = 0;
-    int ok = 0;
-    for (int y = 1; y < height - 1; ++y) {
-        for (int x = 1; x < width - 1; ++x) {
-            double h = water[y][x]; // ̍
-            if (h <= 1e-6) continue; // 1m͐ȂƂi 0.0 Ƃ݂Ȃj
-
-            // ɏ]Ĉړ
-            int dir = flowDir[y][x];
-            int targetX = x;
-            int targetY = y;
-            // R[hɑΉT
-            for (int d = 0; d < 8; ++d) {
-                if (dir == dirCode[d]) {
-                    targetX = x + dxc[d];
-                    targetY = y + dyc[d];
-                    break;
+    const double rain = opts.rainfall;
+    InfiltrationState* infil = opts.infil;
+    const bool source = (rain > 0.0 || infil != nullptr); // ~JEZ邩
+
+    // x͕ʂɑSZ񂳂Ã[v̒Ń^CƂɑĂ
+    MassLedger* ledger = opts.ledger;
+
+    const MfdWeights* mfd = opts.mfd;
+    ChannelState* channel = opts.channel;
+    CellFlags* flags = opts.flags;
+
+    // ^CƂɃXbhɕiõׂ̗Zɏނ̂ŁA4FɕēF̃^Cɉ񂷁j
+    TileGrid tiles = makeTileGrid(width, height, 4 * sizeof(double) + sizeof(int));
+    if (ledger) beginLedgerStep(*ledger, tiles.count());
+    vector<long long> limited(tiles.count(), 0); // oʂ𐧌Zi^CƁj
+
+    forEachTileColored(tiles, [&](const Tile& t) {
+        KahanSum tileStorage, tileInfil; // ̃^C̒ʂƐZ
+        int wet = 0;                     // ̂Z
+        double peak = 0.0;               // ő吅[
+
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                double h = water[y][x]; // ̍
+                tileStorage.add(h);
+                peak = max(peak, h);
+
+                // ~JƐZiʂ̃[vɂAoƓ[vŉj
+                if (source) {
+                    double loss = infil ? infiltrationStep(*infil, (size_t)y * width + x, rain, h + rain, DT) : 0.0;
+                    nextWater[y][x] += rain - loss;
+                    h += rain - loss;
+                    tileInfil.add(loss);
                 }
-            }
-            // zS = tan(XΊp)
-            //double S = tan(wa_slope[y][x] * PI / 180.0);
-            //if (S <= 0.0) S = 1e-6; // nł킸ɗ悤ɂ********************
-            // 
-            // z S 𒼐ځuʍ / ZvŌvZ
-            double dh = surface[y][x] - surface[targetY][targetX];
-            if (dh <= 0.0) continue; // ʂɂ
-
-            double d = (abs(targetX - x) + abs(targetY - y) == 2) ? w * sqrt(2.0) : w; // ΂߂
-            double S = dh / d;
-
-            // }jO
-            double A = h * w;// ρifʐρj(m^2)           
-            double m = 2 * h + w;// (m)            
-            double R = A / m;// a[(m)
-            double v = (1.0 / n) * pow(R, 2.0 / 3.0) * sqrt(S);// [m/s]
-            if (v < 0.001) v = 0.001;  // 闬͍Œɗ}
-
-
-            double Q = v * A * DT;// ړ鐅 Q[m^3/s] = v ~ A
-            double outFlow = Q / (w * w);// [̕ω [m]
-
-            // ̍𒴂Ȃ悤ɐiS΍j******************************************_Iɐ΂Ȃ
-            if (outFlow > h) {
-                outFlow = h;
-                ok++;
-            }
 
-            
-            if (outFlow > dh / 2) {
-                outFlow = dh / 2;// sRȗʂȂ
-                ss++;
-            }
+                if (h <= 1e-6) continue; // 1m͐ȂƂi 0.0 Ƃ݂Ȃj
+
+                if (channel && channel->flags->has((size_t)y * width + x, CELL_CHANNEL)) continue; // ͓Z channelStep ŗ
+
+                // Fz\ɏ]ĉ̃̕Zɕ
+                if (mfd) {
+                    const unsigned char* wt = &mfd->weights[((size_t)y * width + x) * 8];
 
+                    // oʂ͍ŋ}z̃}jOŌ߂iD8Ɠj
+                    double Smax = mfd->slope[(size_t)y * width + x];
+                    if (Smax <= 0.0) continue;
 
+                    double A = h * w;
+                    double R = A / (2 * h + w);
+                    double v = (1.0 / n) * pow(R, 2.0 / 3.0) * sqrt(Smax);
+                    if (v < 0.001) v = 0.001;
+                    double outFlow = v * A * DT / (w * w);
+                    if (outFlow > h) {
+                        outFlow = h;
+                        limited[t.index]++;
+                    }
+
+                    for (int d = 0; d < 8; ++d) {
+                        if (wt[d] == 0) continue;
+                        int nx = x + dxc[d];
+                        int ny = y + dyc[d];
+                        double part = outFlow * wt[d] * (1.0 / 255.0);
+                        double dh = surface[y][x] - surface[ny][nx];
+                        if (part > dh / 2) {
+                            part = dh / 2; // ʂt]Ȃ悤ɂ
+                            limited[t.index]++;
+                        }
+                        nextWater[y][x] -= part;
+                        nextWater[ny][nx] += part;
+                    }
+                    continue;
+                }
+
+                // ɏ]Ĉړ
+                int dir = flowDir[y][x];
+                int targetX = x;
+                int targetY = y;
+                // R[hɑΉT
+                for (int d = 0; d < 8; ++d) {
+                    if (dir == dirCode[d]) {
+                        targetX = x + dxc[d];
+                        targetY = y + dyc[d];
+                        break;
+                    }
+                }
+                // zS = tan(XΊp)
+                //double S = tan(wa_slope[y][x] * PI / 180.0);
+                //if (S <= 0.0) S = 1e-6; // nł킸ɗ悤ɂ********************
+                // 
+                // z S 𒼐ځuʍ / ZvŌvZ
+                double dh = surface[y][x] - surface[targetY][targetX];
+                if (dh <= 0.0) continue; // ʂɂ
+
+                double d = (abs(targetX - x) + abs(targetY - y) == 2) ? w * sqrt(2.0) : w; // ΂߂
+                double S = dh / d;
+
+                // }jO
+                double A = h * w;// ρifʐρj(m^2)           
+                double m = 2 * h + w;// (m)            
+                double R = A / m;// a[(m)
+                double v = (1.0 / n) * pow(R, 2.0 / 3.0) * sqrt(S);// [m/s]
+                if (v < 0.001) v = 0.001;  // 闬͍Œɗ}
+
+
+                double Q = v * A * DT;// ړ鐅 Q[m^3/s] = v ~ A
+                double outFlow = Q / (w * w);// [̕ω [m]
+
+                // ̍𒴂Ȃ悤ɐiS΍j******************************************_Iɐ΂Ȃ
+                if (outFlow > h) {
+                    outFlow = h;
+                    limited[t.index]++;
+                }
 
-            // ̐炵AoɉZ
-            nextWater[y][x] -= outFlow;
-            nextWater[targetY][targetX] += outFlow;
+                
+                if (outFlow > dh / 2) {
+                    outFlow = dh / 2;// sRȗʂȂ
+                    limited[t.index]++;
+                }
+
+
+
+                // ̐炵AoɉZ
+                nextWater[y][x] -= outFlow;
+                nextWater[targetY][targetX] += outFlow;
+            }
+
+            if (flags) wet += updateDryRow(&flags->bits[(size_t)y * width + t.x0], water[y].data() + t.x0, t.x1 - t.x0, 1e-6);
+        }
+
+        if (ledger) {
+            ledger->parts[t.index].storage = tileStorage.sum;
+            ledger->parts[t.index].infil = tileInfil.sum;
+            ledger->parts[t.index].wet = wet;
+            ledger->parts[t.index].hmax = peak;
         }
+    });
+    long long limitedCells = 0;
+    for (long long c : limited) limitedCells += c;
+
+    // 㗬̗i_̃Zj
+    double inflowVolume = 0.0;
+    if (opts.inflows) {
+        inflowVolume = applyInflows(*opts.inflows, nextWater, opts.time, DT);
+    }
+
+    // 1͓̉ïO֏o͋E̗oɊ܂߂j
+    double channelVolume = 0.0;
+    if (channel) {
+        channelVolume = channelStep(*channel, nextWater, DT);
+    }
+
+    // ÖOւ̗o
+    double boundaryVolume = 0.0;
+    if (opts.boundary) {
+        boundaryVolume = applyBoundaries(*opts.boundary, opts.bflux, nextWater, water, surface, width, height, DT, n, channel ? channel->flags : nullptr);
+    }
+
+    // [ςZ CELL_DIRTY tĩXebvŗvZ͈, E͓EE̕܂ށj
+    // [vŐx̒ɐ[̕ω̍ől
+    const bool dirty = flags && !mfd;
+    if (dirty || ledger) {
+        forEachTile(tiles, [&](const Tile& t) {
+            double dh = 0.0;
+            for (int y = t.y0; y < t.y1; ++y) {
+                const double* h0 = water[y].data();
+                const double* h1 = nextWater[y].data();
+                uint8_t* b = dirty ? &flags->bits[(size_t)y * width] : nullptr;
+                for (int x = t.x0; x < t.x1; ++x) {
+                    dh = max(dh, fabs(h1[x] - h0[x]));
+                    if (dirty && h1[x] != h0[x]) b[x] |= CELL_DIRTY;
+                }
+            }
+            if (ledger) ledger->parts[t.index].dhmax = dh;
+        });
     }
-    //cout << "overwater_h:" << ok << "\n";
-    //cout << "ss:" << ss << "\n";
+
+    if (ledger) {
+        finishLedgerStep(*ledger, w * w, rain * w * w * width * height, inflowVolume, boundaryVolume + channelVolume, limitedCells);
+    }
+
     // ʂ water ɏ㏑
-    water = nextWater;
+    water.swap(nextWater);
 }
\ No newline at end of file
@@ -11,13 +11,48 @@ extern const int dirCode[8]; // D8
 
 using namespace std;
 
+struct InfiltrationState; // infiltration.h
+struct BoundaryConfig;    // boundary.h
+struct BoundaryFlux;      // boundary.h
+struct InflowSource;      // inflow.h
+struct MassLedger;        // massbalance.h
+struct MfdWeights;        // mfd.h
+struct ChannelState;      // channel.h
+struct CellFlags;         // cellflags.h
+
+// vZGW
+enum class SolverEngine {
+    D8,           // D8Ƀ}jOŗisimulateWaterFlowj
+    LocalInertial // Ǐߎ2󐅗isimulateLocalInertial, inertial.hj
+};
+
+// oƓ[vŏǉ
+struct FlowOptions {
+    double rainfall = 0.0;              // 1Xebv̍~J [m]
+    InfiltrationState* infil = nullptr; // Zinullptr ȂZȂj
+    const BoundaryConfig* boundary = nullptr; // ŐEinullptr ȂEj
+    BoundaryFlux* bflux = nullptr;            // E̗oʂ̋L^
+    vector<InflowSource>* inflows = nullptr;  // 㗬̗_
+    double time = 0.0;                        // XebvJn̎ [s]inChOtpj
+    MassLedger* ledger = nullptr;             // x̒i[vŏWvj
+    const MfdWeights* mfd = nullptr;          // ̔z\inullptr Ȃ flowDir D8j
+    ChannelState* channel = nullptr;          // 1͓̉inullptr Ȃ2ŗj
+    CellFlags* flags = nullptr;               // Z̎ށiXebvJn̐[ CELL_DRY tj
+};
+
 // V~[V֐̐錾
 void simulateWaterFlow(
     vector<vector<double>>& water,
     const vector<vector<int>>& flowDir,
     const vector<vector<double>>& surface,
     int width, int height,
-    double DT, double n = 0.03
+    double DT, double n = 0.03,
+    const FlowOptions& opts = FlowOptions()
 );
 
+// river_sim.cpp ̊֐iensemble.cpp łgj
+vector<vector<double>> TotalHeight(const vector<vector<double>>& data, const vector<vector<double>>& water, int width, int height); // W + [
+vector<vector<int>> computeFlowDirection(const vector<vector<double>>& dem, int width, int height); // D8̗
+size_t updateFlowDirection(const vector<vector<double>>& surface, vector<vector<int>>& flowDir, CellFlags& flags, int width, int height); // CELL_DIRTY ̋߂vZ
+
 #endif // SIMULATE_H
\ No newline at end of file
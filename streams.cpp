@@ -0,0 +1,163 @@
+﻿#include "streams.h"
+#include "simulate.h"
+#include "stb_image_write.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+
+// 河道網の抽出
+StreamNetwork extractStreams(const FlowAccumulation& acc, const vector<vector<double>>& dem, CellFlags& flags, uint32_t threshold) {
+    StreamNetwork net;
+    const int width = acc.width;
+    const int height = acc.height;
+    const size_t cells = (size_t)width * height;
+    const uint32_t* down = acc.down.data();
+    net.width = width;
+    net.height = height;
+
+    // 河道のセル（下流へたどって途切れないようにする）
+    vector<unsigned char> stream(cells, 0);
+    for (size_t i = 0; i < cells; ++i) {
+        if (acc.count[i] >= threshold || flags.has(i, CELL_WATERBODY)) stream[i] = 1;
+    }
+    for (size_t i = 0; i < cells; ++i) {
+        if (!stream[i]) continue;
+        for (uint32_t j = down[i]; j != FLOW_NONE && !stream[j]; j = down[j]) stream[j] = 1;
+    }
+    for (size_t i = 0; i < cells; ++i) {
+        if (stream[i]) flags.set(i, CELL_RIVER);
+        else flags.clear(i, CELL_RIVER);
+    }
+
+    // 上流の河道セルの数（1 以外なら区間の始まり）
+    vector<unsigned char> indeg(cells, 0);
+    vector<uint32_t> starts;
+    for (uint32_t i = 0; i < (uint32_t)cells; ++i) {
+        if (stream[i] && down[i] != FLOW_NONE) indeg[down[i]]++;
+    }
+    for (uint32_t i = 0; i < (uint32_t)cells; ++i) {
+        if (!stream[i]) continue;
+        if (indeg[i] != 1) starts.push_back(i);
+        if (indeg[i] >= 2) net.junctions.push_back(i);
+    }
+
+    // 累積セル数は下流ほど大きいので、その順に並べれば上流の区間が先になる
+    sort(starts.begin(), starts.end(), [&](uint32_t a, uint32_t b) {
+        return (acc.count[a] != acc.count[b]) ? acc.count[a] < acc.count[b] : a < b;
+    });
+
+    const size_t n = starts.size();
+    net.reachOfCell.assign(cells, FLOW_NONE);
+    net.cellStart.assign(n + 1, 0);
+    net.downstream.assign(n, FLOW_NONE);
+    net.order.assign(n, 1);
+    net.length.assign(n, 0.0f);
+    net.slope.assign(n, 0.0f);
+
+    // 区間をたどる
+    vector<uint32_t> next(n, FLOW_NONE); // 区間の下流端の次のセル（合流点）
+    for (size_t r = 0; r < n; ++r) {
+        net.cellStart[r] = (uint32_t)net.cellList.size();
+        uint32_t i = starts[r];
+        double len = 0.0;
+        for (;;) {
+            net.cellList.push_back(i);
+            net.reachOfCell[i] = (uint32_t)r;
+            uint32_t j = down[i];
+            if (j == FLOW_NONE) {
+                len += w; // 領域の外へ1セル分
+                break;
+            }
+            bool diag = (j / width != i / width) && (j % width != i % width);
+            len += diag ? w * sqrt(2.0) : w;
+            if (indeg[j] != 1) {
+                next[r] = j;
+                break;
+            }
+            i = j;
+        }
+
+        uint32_t first = net.cellList[net.cellStart[r]];
+        uint32_t last = (next[r] != FLOW_NONE) ? next[r] : i;
+        double dz = dem[first / width][first % width] - dem[last / width][last % width];
+        net.length[r] = (float)len;
+        net.slope[r] = (float)max(0.0, dz / len);
+    }
+    net.cellStart[n] = (uint32_t)net.cellList.size();
+
+    // 区間どうしのつながり
+    net.upStart.assign(n + 1, 0);
+    for (size_t r = 0; r < n; ++r) {
+        if (next[r] == FLOW_NONE) continue;
+        net.downstream[r] = net.reachOfCell[next[r]];
+        net.upStart[net.downstream[r] + 1]++;
+    }
+    for (size_t r = 0; r < n; ++r) net.upStart[r + 1] += net.upStart[r];
+    net.upList.resize(net.upStart[n]);
+    vector<uint32_t> fill(net.upStart.begin(), net.upStart.end() - 1);
+    for (size_t r = 0; r < n; ++r) {
+        if (net.downstream[r] != FLOW_NONE) net.upList[fill[net.downstream[r]]++] = (uint32_t)r;
+    }
+
+    // Strahler次数（上流の区間は番号が小さいので先に決まっている）
+    for (size_t r = 0; r < n; ++r) {
+        unsigned char top = 0;
+        int topCount = 0;
+        for (uint32_t k = net.upStart[r]; k < net.upStart[r + 1]; ++k) {
+            unsigned char o = net.order[net.upList[k]];
+            if (o > top) {
+                top = o;
+                topCount = 1;
+            }
+            else if (o == top) {
+                ++topCount;
+            }
+        }
+        if (top > 0) net.order[r] = (unsigned char)(topCount >= 2 ? top + 1 : top);
+    }
+
+    return net;
+}
+
+// 区間の一覧
+bool saveStreamCsv(const StreamNetwork& net, const string& filename) {
+    ofstream file(filename);
+    if (!file) {
+        cerr << "ファイルを開けません: " << filename << "\n";
+        return false;
+    }
+    file << "reach,order,cells,length,slope,downstream,start_y,start_x,end_y,end_x\n";
+    for (size_t r = 0; r < net.reaches(); ++r) {
+        uint32_t first = net.cellList[net.cellStart[r]];
+        uint32_t last = net.cellList[net.cellStart[r + 1] - 1];
+        file << r << "," << (int)net.order[r] << "," << net.cellStart[r + 1] - net.cellStart[r] << ","
+             << net.length[r] << "," << net.slope[r] << ",";
+        if (net.downstream[r] == FLOW_NONE) file << -1;
+        else file << net.downstream[r];
+        file << "," << first / net.width << "," << first % net.width << ","
+             << last / net.width << "," << last % net.width << "\n";
+    }
+    return true;
+}
+
+// 河道の画像（次数が大きいほど明るい）
+void saveStreamImage(const StreamNetwork& net, const char* filename) {
+    unsigned char maxOrder = 1;
+    for (unsigned char o : net.order) maxOrder = max(maxOrder, o);
+
+    vector<unsigned char> image(net.reachOfCell.size(), 0);
+    for (size_t i = 0; i < image.size(); ++i) {
+        uint32_t r = net.reachOfCell[i];
+        if (r == FLOW_NONE) continue;
+        image[i] = (unsigned char)(55 + 200 * net.order[r] / maxOrder);
+    }
+
+    if (stbi_write_png(filename, net.width, net.height, 1, image.data(), net.width)) {
+        cout << "河道画像保存成功: " << filename << "\n";
+    }
+    else {
+        cerr << "河道画像保存失敗: " << filename << "\n";
+    }
+}
@@ -0,0 +1,46 @@
+﻿#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "flowacc.h"
+#include "cellflags.h"
+
+using namespace std;
+
+// 河道網（区間ごとの配列をまとめて持つ）
+// 区間は源頭または合流点から次の合流点の手前（または出口）までのセルの並び
+// 区間の番号は上流から順に付くので、下流の区間の番号は必ず自分より大きい
+struct StreamNetwork {
+    int width = 0;
+    int height = 0;
+    vector<uint32_t> reachOfCell;  // セルごとの区間番号（河道でなければ FLOW_NONE）
+
+    // 区間ごと
+    vector<uint32_t> cellStart;    // cellList[cellStart[r]] 〜 cellList[cellStart[r+1]-1]（上流 → 下流）
+    vector<uint32_t> cellList;
+    vector<uint32_t> downstream;   // 流れ込む先の区間（なし = FLOW_NONE）
+    vector<uint32_t> upStart;      // 上流の区間（upList[upStart[r]] 〜 upList[upStart[r+1]-1]）
+    vector<uint32_t> upList;
+    vector<unsigned char> order;   // Strahler次数
+    vector<float> length;          // 区間の長さ [m]（次の合流点まで）
+    vector<float> slope;           // 区間の平均勾配
+
+    vector<uint32_t> junctions;    // 合流点のセル
+
+    size_t reaches() const { return downstream.size(); }
+};
+
+// 河道網の抽出
+// 累積セル数が threshold 以上のセルと水域のセル（CELL_WATERBODY）を河道とし、その下流も河道として繋げる
+// 河道網のセルには CELL_RIVER を付ける
+StreamNetwork extractStreams(const FlowAccumulation& acc, const vector<vector<double>>& dem, CellFlags& flags, uint32_t threshold);
+
+// 区間の一覧（区間,次数,セル数,長さ,勾配,下流の区間,始点y,x,終点y,x）
+bool saveStreamCsv(const StreamNetwork& net, const string& filename);
+
+// 河道の画像（次数が大きいほど明るい）
+void saveStreamImage(const StreamNetwork& net, const char* filename);
+
+#endif // STREAMS_H
@@ -0,0 +1,146 @@
+﻿#include "terrain.h"
+#include "simulate.h"
+#include "tiling.h"
+#include "stb_image_write.h"
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+static const double RAD2DEG = 57.29577951308232;
+
+
+// 地形量をまとめて計算する
+TerrainProducts computeTerrain(const vector<vector<double>>& dem, int width, int height, const FlowAccumulation* acc, const TerrainOptions& opt) {
+    TerrainProducts tp;
+    tp.width = width;
+    tp.height = height;
+    const size_t cells = (size_t)width * height;
+    tp.slope.assign(cells, 0.0f);
+    tp.aspect.assign(cells, 0.0f);
+    tp.hillshade.assign(cells, 0);
+    tp.profileCurv.assign(cells, 0.0f);
+    tp.planCurv.assign(cells, 0.0f);
+    tp.twi.assign(cells, 0.0f);
+    if (width < 3 || height < 3) return tp;
+
+    const double L = w;
+    const double inv8 = 1.0 / (8.0 * L);
+    const double invL2 = 1.0 / (L * L);
+
+    // 光源の向き（東, 北, 上）
+    const double az = opt.sunAzimuth / RAD2DEG;
+    const double alt = opt.sunAltitude / RAD2DEG;
+    const double lx = cos(alt) * sin(az);
+    const double ly = cos(alt) * cos(az);
+    const double lz = sin(alt);
+
+    const uint32_t* count = (acc && acc->count.size() == cells) ? acc->count.data() : nullptr;
+
+    // 3x3 の近傍を読むのでハローは1セル（外周のセルは計算しない）
+    TileGrid tiles = makeTileGrid(width, height, sizeof(double) + 5 * sizeof(float) + 1);
+    forEachTile(tiles, [&](const Tile& t) {
+        const int x0 = max(t.x0, 1);
+        const int x1 = min(t.x1, width - 1);
+
+        for (int y = max(t.y0, 1); y < min(t.y1, height - 1); ++y) {
+            const double* r0 = dem[y - 1].data(); // 北
+            const double* r1 = dem[y].data();
+            const double* r2 = dem[y + 1].data(); // 南
+
+            for (int x = x0; x < x1; ++x) {
+                // 3x3 の近傍（z1 z2 z3 / z4 z5 z6 / z7 z8 z9, 上が北）
+                const double z1 = r0[x - 1], z2 = r0[x], z3 = r0[x + 1];
+                const double z4 = r1[x - 1], z5 = r1[x], z6 = r1[x + 1];
+                const double z7 = r2[x - 1], z8 = r2[x], z9 = r2[x + 1];
+                const size_t i = (size_t)y * width + x;
+
+                // Sobel の勾配（zx: 東向き, zy: 北向きの上り勾配）
+                double zx = ((z3 + 2 * z6 + z9) - (z1 + 2 * z4 + z7)) * inv8;
+                double zy = ((z1 + 2 * z2 + z3) - (z7 + 2 * z8 + z9)) * inv8;
+                double g2 = zx * zx + zy * zy;
+                double grad = sqrt(g2);
+
+                tp.slope[i] = (float)(atan(grad) * RAD2DEG);
+                double A = atan2(-zy, -zx) * RAD2DEG; // 傾きと逆向きを正
+                if (A < 0) A += 360.0;
+                tp.aspect[i] = (float)A;
+
+                // 陰影：法線 (-zx, -zy, 1) と光源の内積
+                double hs = (-zx * lx - zy * ly + lz) / sqrt(1.0 + g2);
+                tp.hillshade[i] = (unsigned char)(255.0 * (hs > 0.0 ? hs : 0.0));
+
+                // 曲率（Zevenbergen & Thorne 1987）
+                double D = ((z4 + z6) * 0.5 - z5) * invL2;
+                double E = ((z2 + z8) * 0.5 - z5) * invL2;
+                double F = (-z1 + z3 + z7 - z9) * 0.25 * invL2;
+                double G = (z6 - z4) / (2.0 * L);
+                double H = (z2 - z8) / (2.0 * L);
+                double gh = G * G + H * H;
+                if (gh > 1e-12) {
+                    tp.profileCurv[i] = (float)(-2.0 * (D * G * G + E * H * H + F * G * H) / gh);
+                    tp.planCurv[i] = (float)(2.0 * (D * H * H + E * G * G - F * G * H) / gh);
+                }
+
+                // TWI = ln(比集水面積 / tanβ)（等高線長はセル幅）
+                if (count) {
+                    double a = count[i] * L;
+                    double tb = (grad > 1e-4) ? grad : 1e-4;
+                    tp.twi[i] = (float)log(a / tb);
+                }
+            }
+        }
+    });
+    return tp;
+}
+
+static void writeGray(const vector<unsigned char>& image, int width, int height, const string& filename, const char* label) {
+    if (stbi_write_png(filename.c_str(), width, height, 1, image.data(), width)) {
+        cout << label << "画像保存成功: " << filename << "\n";
+    }
+    else {
+        cerr << label << "画像保存失敗: " << filename << "\n";
+    }
+}
+
+// 曲率の画像（0 を灰色にし、二乗平均の3倍で振り切る）
+static void saveCurvature(const vector<float>& c, int width, int height, const string& filename, const char* label) {
+    double ss = 0.0;
+    for (float v : c) ss += (double)v * v;
+    double range = 3.0 * sqrt(ss / max<size_t>(c.size(), 1));
+    if (range <= 0.0) range = 1.0;
+
+    vector<unsigned char> image(c.size());
+    for (size_t i = 0; i < c.size(); ++i) {
+        double g = 128.0 + 127.0 * c[i] / range;
+        image[i] = (unsigned char)min(max(g, 0.0), 255.0);
+    }
+    writeGray(image, width, height, filename, label);
+}
+
+// 陰影・縦断曲率・平面曲率・TWI の画像
+void saveTerrainImages(const TerrainProducts& tp, const string& dir) {
+    writeGray(tp.hillshade, tp.width, tp.height, dir + "hillshade_output.png", "陰影");
+    saveCurvature(tp.profileCurv, tp.width, tp.height, dir + "profcurv_output.png", "縦断曲率");
+    saveCurvature(tp.planCurv, tp.width, tp.height, dir + "plancurv_output.png", "平面曲率");
+
+    // TWI は内部のセルの最小・最大で正規化
+    float lo = 0.0f, hi = 0.0f;
+    bool first = true;
+    for (int y = 1; y < tp.height - 1; ++y) {
+        for (int x = 1; x < tp.width - 1; ++x) {
+            float v = tp.twi[(size_t)y * tp.width + x];
+            if (first || v < lo) lo = v;
+            if (first || v > hi) hi = v;
+            first = false;
+        }
+    }
+    cout << "TWI:" << lo << "〜" << hi << "\n";
+    vector<unsigned char> image(tp.twi.size(), 0);
+    if (hi > lo) {
+        for (size_t i = 0; i < image.size(); ++i) {
+            double g = (tp.twi[i] - lo) / (hi - lo);
+            image[i] = (unsigned char)(255.0 * min(max(g, 0.0), 1.0));
+        }
+    }
+    writeGray(image, tp.width, tp.height, dir + "twi_output.png", "TWI");
+}
@@ -0,0 +1,34 @@
+﻿#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <vector>
+#include <string>
+#include "flowacc.h"
+
+using namespace std;
+
+struct TerrainOptions {
+    double sunAzimuth = 315.0; // 陰影の光源の方位 [度]（北から時計回り）
+    double sunAltitude = 45.0; // 陰影の光源の高度 [度]
+};
+
+// 地形量（セルの値は y * width + x, 外周のセルは 0）
+struct TerrainProducts {
+    int width = 0;
+    int height = 0;
+    vector<float> slope;         // 傾斜角 [度]
+    vector<float> aspect;        // 方位角 [度]（makeAspect と同じ：東から反時計回りの下り方向）
+    vector<unsigned char> hillshade; // 陰影 0..255
+    vector<float> profileCurv;   // 縦断曲率 [1/m]（Zevenbergen & Thorne 1987, 正なら凸で流れが加速）
+    vector<float> planCurv;      // 平面曲率 [1/m]（正なら流れが広がる）
+    vector<float> twi;           // 地形湿潤指数 ln(a / tanβ)（流量累積がないときは 0）
+};
+
+// 地形量をまとめて計算する
+// 3x3 の近傍を1回読むだけで、Sobel の勾配・陰影・曲率・TWI を同時に求める（タイル単位でスレッドに分ける）
+TerrainProducts computeTerrain(const vector<vector<double>>& dem, int width, int height, const FlowAccumulation* acc = nullptr, const TerrainOptions& opt = TerrainOptions());
+
+// 陰影・縦断曲率・平面曲率・TWI の画像（dir + "hillshade_output.png" など）
+void saveTerrainImages(const TerrainProducts& tp, const string& dir);
+
+#endif // TERRAIN_H
@@ -0,0 +1,139 @@
+﻿#ifndef TILING_H
+#define TILING_H
+
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// タイル1枚（ハロー込み）の作業量の目安 [byte]（L2 に収まる大きさ）
+const size_t TILE_CACHE_BYTES = 256 * 1024;
+
+// タイルの範囲（x0 <= x < x1, y0 <= y < y1, ハローは含まない）
+struct Tile {
+    int index = 0; // タイルの番号（タイルごとの部分和などに使う）
+    int x0 = 0, y0 = 0;
+    int x1 = 0, y1 = 0;
+};
+
+// グリッドのタイル分割
+// 3x3 の近傍を読むカーネルでも、タイルの行（とハロー）がキャッシュに残ったまま次の行に進める
+struct TileGrid {
+    int width = 0;
+    int height = 0;
+    int tileRows = 0;
+    int tileCols = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    int halo = 1; // 近傍を読む（書く）幅
+
+    int count() const { return tilesX * tilesY; }
+
+    Tile tile(int t) const {
+        Tile r;
+        r.index = t;
+        r.y0 = (t / tilesX) * tileRows;
+        r.x0 = (t % tilesX) * tileCols;
+        r.y1 = min(r.y0 + tileRows, height);
+        r.x1 = min(r.x0 + tileCols, width);
+        return r;
+    }
+};
+
+// タイル分割を決める
+// bytesPerCell: 1セルあたりに読み書きする量（配列の数 × 要素の大きさ）
+// ハロー込みのタイルが cacheBytes に収まる大きさにし、幅が狭いグリッドでは行全体を1枚にする
+// 行方向にも分けて、スレッドに配れるだけのタイル数を確保する
+inline TileGrid makeTileGrid(int width, int height, size_t bytesPerCell, int halo = 1, size_t cacheBytes = TILE_CACHE_BYTES) {
+    TileGrid g;
+    g.width = width;
+    g.height = height;
+    g.halo = halo;
+    if (width <= 0 || height <= 0) return g;
+
+    const int minSide = max(2 * halo, 2); // 同じ色のタイルが1枚以上離れる大きさ（forEachTileColored）
+    const size_t cells = max<size_t>(cacheBytes / max<size_t>(bytesPerCell, 1), 64);
+
+    // 列：正方形に近い大きさ（64 の倍数）を上限に、端数が出ないように均等に分ける
+    int side = (int)sqrt((double)cells);
+    side = max(64, side / 64 * 64);
+    int tilesX = (width + side - 1) / side;
+    g.tileCols = max((width + tilesX - 1) / tilesX, min(minSide, width));
+    g.tilesX = (width + g.tileCols - 1) / g.tileCols;
+
+    // 行：残りの量に収まる行数（少なくとも16枚くらいには分ける）
+    int rows = (int)(cells / (size_t)(g.tileCols + 2 * halo)) - 2 * halo;
+    rows = min(rows, (height + 15) / 16);
+    g.tileRows = max(rows, min(minSide, height));
+    g.tilesY = (height + g.tileRows - 1) / g.tileRows;
+    return g;
+}
+
+// タイルごとに f(const Tile&) を呼ぶ（タイル単位でスレッドに分ける）
+// 自分のタイルのセルにしか書き込まないカーネル用
+template <class F>
+void forEachTile(const TileGrid& g, F f) {
+    const int n = g.count();
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < n; ++t) {
+        f(g.tile(t));
+    }
+}
+
+// OpenMP 4.0 以降ならスレッドの置き場所（proc_bind）を指定する
+// MSVC の /openmp（2.0）には proc_bind がないので、OMP_PROC_BIND=spread,close と OMP_PLACES で指定する
+#if defined(_OPENMP) && _OPENMP >= 201307
+#define RIVER_SIM_OMP_PROC_BIND 1
+#else
+#define RIVER_SIM_OMP_PROC_BIND 0
+#endif
+
+// タイルごとに f(const Tile&) を threads 個のスレッドで呼ぶ（入れ子の並列の内側用）
+// 外側のスレッドと同じ場所（ソケット）の近くにスレッドを置く（proc_bind(close)）
+template <class F>
+void forEachTile(const TileGrid& g, int threads, F f) {
+    const int n = g.count();
+#if RIVER_SIM_OMP_PROC_BIND
+#pragma omp parallel for schedule(dynamic) num_threads(threads) proc_bind(close)
+#else
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+    for (int t = 0; t < n; ++t) {
+        f(g.tile(t));
+    }
+}
+
+// f(p) を p = 0..groups-1 について1つずつのスレッドで呼ぶ（入れ子の並列の外側用）
+// スレッドは場所（ソケット）に散らし（proc_bind(spread)）、schedule(static, 1) なので p は毎回同じスレッドが受け持つ
+template <class F>
+void forEachGroup(int groups, F f) {
+#if RIVER_SIM_OMP_PROC_BIND
+#pragma omp parallel for schedule(static, 1) num_threads(groups) proc_bind(spread)
+#else
+#pragma omp parallel for schedule(static, 1) num_threads(groups)
+#endif
+    for (int p = 0; p < groups; ++p) {
+        f(p);
+    }
+}
+
+// タイルを (tx % 2, ty % 2) の4色に分け、色ごとに f(const Tile&) を呼ぶ
+// 同じ色のタイルどうしは1枚以上離れているので、ハローの範囲の隣のセルに書き込むカーネルでも同時に回せる
+template <class F>
+void forEachTileColored(const TileGrid& g, F f) {
+    for (int color = 0; color < 4; ++color) {
+        const int cx = color % 2;
+        const int cy = color / 2;
+        const int nx = (g.tilesX - cx + 1) / 2;
+        const int ny = (g.tilesY - cy + 1) / 2;
+#pragma omp parallel for schedule(dynamic)
+        for (int k = 0; k < nx * ny; ++k) {
+            int tx = cx + 2 * (k % nx);
+            int ty = cy + 2 * (k / nx);
+            f(g.tile(ty * g.tilesX + tx));
+        }
+    }
+}
+
+#endif // TILING_H
@@ -0,0 +1,197 @@
+﻿#include "voidfill.h"
+#include "simulate.h"
+#include <cmath>
+#include <algorithm>
+
+// 解像度の段（値は重み付き平均, 重みは 0..1）
+struct FillLevel {
+    int width = 0;
+    int height = 0;
+    vector<double> value;
+    vector<double> weight;
+};
+
+// 2x2 ずつまとめた粗い段を作る
+static FillLevel pushLevel(const FillLevel& fine) {
+    FillLevel c;
+    c.width = (fine.width + 1) / 2;
+    c.height = (fine.height + 1) / 2;
+    c.value.assign((size_t)c.width * c.height, 0.0);
+    c.weight.assign((size_t)c.width * c.height, 0.0);
+
+    for (int y = 0; y < c.height; ++y) {
+        for (int x = 0; x < c.width; ++x) {
+            double sv = 0.0, sw = 0.0;
+            for (int dy = 0; dy < 2; ++dy) {
+                for (int dx = 0; dx < 2; ++dx) {
+                    int fx = 2 * x + dx;
+                    int fy = 2 * y + dy;
+                    if (fx >= fine.width || fy >= fine.height) continue;
+                    size_t i = (size_t)fy * fine.width + fx;
+                    sv += fine.value[i] * fine.weight[i];
+                    sw += fine.weight[i];
+                }
+            }
+            size_t k = (size_t)y * c.width + x;
+            c.value[k] = (sw > 0.0) ? sv / sw : 0.0;
+            c.weight[k] = min(sw, 1.0);
+        }
+    }
+    return c;
+}
+
+// 粗い段から双線形補間で細かい段の足りない分を埋める
+static void pullLevel(FillLevel& fine, const FillLevel& c, vector<unsigned char>& empty) {
+    empty.assign((size_t)fine.width * fine.height, 0);
+    for (int y = 0; y < fine.height; ++y) {
+        double cy = y * 0.5 - 0.25;
+        int y0 = (int)floor(cy);
+        double fy = cy - y0;
+        int ya = min(max(y0, 0), c.height - 1);
+        int yb = min(max(y0 + 1, 0), c.height - 1);
+
+        for (int x = 0; x < fine.width; ++x) {
+            size_t i = (size_t)y * fine.width + x;
+            double wt = fine.weight[i];
+            if (wt >= 1.0) continue;
+            if (wt <= 0.0) empty[i] = 1;
+
+            double cx = x * 0.5 - 0.25;
+            int x0 = (int)floor(cx);
+            double fx = cx - x0;
+            int xa = min(max(x0, 0), c.width - 1);
+            int xb = min(max(x0 + 1, 0), c.width - 1);
+
+            const double* ra = &c.value[(size_t)ya * c.width];
+            const double* rb = &c.value[(size_t)yb * c.width];
+            double v = (1.0 - fy) * ((1.0 - fx) * ra[xa] + fx * ra[xb]) + fy * ((1.0 - fx) * rb[xa] + fx * rb[xb]);
+
+            fine.value[i] = wt * fine.value[i] + (1.0 - wt) * v;
+            fine.weight[i] = 1.0;
+        }
+    }
+}
+
+// 値のないセルだけラプラス方程式のガウス・ザイデル法でならす
+static void smoothLevel(FillLevel& lv, const vector<unsigned char>& empty, int iterations) {
+    const int W = lv.width;
+    const int H = lv.height;
+    vector<double>& z = lv.value;
+    for (int it = 0; it < iterations; ++it) {
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                size_t i = (size_t)y * W + x;
+                if (!empty[i]) continue;
+                double sum = 0.0;
+                int n = 0;
+                if (x > 0) { sum += z[i - 1]; ++n; }
+                if (x < W - 1) { sum += z[i + 1]; ++n; }
+                if (y > 0) { sum += z[i - W]; ++n; }
+                if (y < H - 1) { sum += z[i + W]; ++n; }
+                if (n > 0) z[i] = sum / n;
+            }
+        }
+    }
+}
+
+// 欠損値（水域）の補間
+size_t fillVoids(vector<vector<double>>& data, int width, int height, const VoidFillOptions& opt, CellFlags* flags) {
+    const size_t cells = (size_t)width * height;
+    vector<unsigned char> isVoid(cells, 0);
+    size_t count = 0;
+
+    vector<FillLevel> levels(1);
+    FillLevel& base = levels[0];
+    base.width = width;
+    base.height = height;
+    base.value.assign(cells, 0.0);
+    base.weight.assign(cells, 0.0);
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t)y * width + x;
+            if (data[y][x] == opt.nodata) {
+                isVoid[i] = 1;
+                ++count;
+                if (flags) flags->set(i, CELL_WATERBODY);
+            }
+            else {
+                base.value[i] = data[y][x];
+                base.weight[i] = 1.0;
+            }
+        }
+    }
+    if (flags) labelWaterBodies(*flags);
+    if (count == 0) return 0;
+    if (count == cells) {
+        for (auto& row : data) fill(row.begin(), row.end(), 0.0); // 有効なデータがない
+        return count;
+    }
+
+    // 1. push-pull（細かい段に戻すたびに、値のなかったセルをならす）
+    //    粗い段でならした結果が細かい段の初期値になるので、各段数回の反復でラプラス方程式の解に近づく
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        FillLevel next = pushLevel(levels.back());
+        levels.push_back(move(next));
+    }
+    vector<unsigned char> empty;
+    for (size_t l = levels.size() - 1; l-- > 0;) {
+        pullLevel(levels[l], levels[l + 1], empty);
+        smoothLevel(levels[l], empty, opt.smoothIterations);
+    }
+    vector<double>& z = levels[0].value;
+
+    // 2. 河床（岸からの距離はチャンファー距離変換の2パスで求める）
+    vector<double> dist;
+    if (opt.bathymetry == Bathymetry::DistanceScaled) {
+        const double INF = 1e30;
+        const double diag = sqrt(2.0);
+        dist.assign(cells, INF);
+        for (size_t i = 0; i < cells; ++i) {
+            if (!isVoid[i]) dist[i] = 0.0;
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                size_t i = (size_t)y * width + x;
+                double d = dist[i];
+                if (x > 0) d = min(d, dist[i - 1] + 1.0);
+                if (y > 0) {
+                    d = min(d, dist[i - width] + 1.0);
+                    if (x > 0) d = min(d, dist[i - width - 1] + diag);
+                    if (x < width - 1) d = min(d, dist[i - width + 1] + diag);
+                }
+                dist[i] = d;
+            }
+        }
+        for (int y = height - 1; y >= 0; --y) {
+            for (int x = width - 1; x >= 0; --x) {
+                size_t i = (size_t)y * width + x;
+                double d = dist[i];
+                if (x < width - 1) d = min(d, dist[i + 1] + 1.0);
+                if (y < height - 1) {
+                    d = min(d, dist[i + width] + 1.0);
+                    if (x < width - 1) d = min(d, dist[i + width + 1] + diag);
+                    if (x > 0) d = min(d, dist[i + width - 1] + diag);
+                }
+                dist[i] = d;
+            }
+        }
+    }
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t)y * width + x;
+            if (!isVoid[i]) continue;
+
+            double cut = 0.0;
+            if (opt.bathymetry == Bathymetry::Constant) {
+                cut = opt.depth;
+            }
+            else if (opt.bathymetry == Bathymetry::DistanceScaled) {
+                cut = min(opt.depth, opt.shoreSlope * dist[i] * w);
+            }
+            data[y][x] = z[i] - cut;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,32 @@
+﻿#ifndef VOIDFILL_H
+#define VOIDFILL_H
+
+#include <vector>
+#include "cellflags.h"
+
+using namespace std;
+
+// 水域の河床の決め方
+enum class Bathymetry {
+    None,          // 補間した高さのまま（水面）
+    Constant,      // 一律に depth 下げる
+    DistanceScaled // 岸からの距離に比例して下げる（最大 depth）
+};
+
+struct VoidFillOptions {
+    double nodata = -9999.0;               // 欠損値
+    Bathymetry bathymetry = Bathymetry::Constant;
+    double depth = 3.0;                    // 水深 [m]（DistanceScaled では最大値）
+    double shoreSlope = 0.2;               // DistanceScaled：岸から1mあたり下げる量
+    int smoothIterations = 8;              // 各段のラプラス平滑化の回数
+};
+
+// 欠損値（水域）の補間
+// 1. 2x2 ずつまとめた解像度の段を作り（push）、粗い段から細かい段へ双線形補間で埋める（pull）
+//    段を戻るたびに、値のなかったセルをラプラス方程式のガウス・ザイデル法で数回ならす（カスケード型マルチグリッド）
+// 2. 岸からの距離（チャンファー距離変換）を使って河床を下げる
+// どれもセル数に比例する計算量なので、大きな湖や川でも1回で埋まる
+// flags: 欠損だったセルに CELL_WATERBODY を付け、水域に番号を付ける（nullptr なら記録しない）
+size_t fillVoids(vector<vector<double>>& data, int width, int height, const VoidFillOptions& opt = VoidFillOptions(), CellFlags* flags = nullptr);
+
+#endif // VOIDFILL_H
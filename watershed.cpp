@@ -0,0 +1,192 @@
+﻿#include "watershed.h"
+#include "simulate.h"
+#include "stb_image_write.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+
+
+// 流向から小流域に分ける
+// 入次数が 0 のセル（尾根）から流下先へ順に進め（Kahn法）、ためたセル数が targetCells に達したら区切る
+// 区切ったセルの番号は処理順に付くので、上流の小流域ほど小さい番号になる
+Watershed delineateWatersheds(const FlowAccumulation& acc, uint32_t targetCells) {
+    Watershed ws;
+    ws.width = acc.width;
+    ws.height = acc.height;
+    const int width = acc.width;
+    const int height = acc.height;
+    const size_t cells = (size_t)width * height;
+    const uint32_t* down = acc.down.data();
+    if (targetCells == 0) targetCells = 1;
+
+    // 入次数（隣のセルから集める）
+    vector<unsigned char> indeg(cells, 0);
+#pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint32_t i = (uint32_t)((size_t)y * width + x);
+            unsigned char k = 0;
+            for (int d = 0; d < 8; ++d) {
+                int nx = x + dxc[d];
+                int ny = y + dyc[d];
+                if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+                if (down[(size_t)ny * width + nx] == i) ++k;
+            }
+            indeg[i] = k;
+        }
+    }
+
+    // 上流 → 下流の順序と区切り
+    vector<uint32_t> order;
+    order.reserve(cells);
+    for (uint32_t i = 0; i < (uint32_t)cells; ++i) {
+        if (indeg[i] == 0) order.push_back(i);
+    }
+
+    vector<uint32_t> pending(cells, 0); // まだ区切られていない上流のセル数
+    ws.label.assign(cells, FLOW_NONE);
+    for (size_t k = 0; k < order.size(); ++k) {
+        uint32_t i = order[k];
+        pending[i] += 1;
+        uint32_t j = down[i];
+
+        if (j == FLOW_NONE || pending[i] >= targetCells) {
+            ws.label[i] = (uint32_t)ws.outlet.size(); // 区切り（小流域の出口）
+            ws.outlet.push_back(i);
+            ws.cells.push_back(pending[i]);
+        }
+        else {
+            pending[j] += pending[i];
+        }
+
+        if (j != FLOW_NONE && --indeg[j] == 0) order.push_back(j);
+    }
+
+    // 下流 → 上流の順に番号を広げる（流向が循環しているセルは order に入らず番号なし）
+    for (size_t k = order.size(); k-- > 0;) {
+        uint32_t i = order[k];
+        if (ws.label[i] == FLOW_NONE && down[i] != FLOW_NONE) ws.label[i] = ws.label[down[i]];
+    }
+
+    // 小流域どうしのつながり
+    const size_t n = ws.outlet.size();
+    ws.downstream.assign(n, FLOW_NONE);
+    ws.level.assign(n, 0);
+    ws.upStart.assign(n + 1, 0);
+    for (size_t s = 0; s < n; ++s) {
+        uint32_t j = down[ws.outlet[s]];
+        if (j == FLOW_NONE) continue;
+        uint32_t ds = ws.label[j];
+        ws.downstream[s] = ds;
+        ws.level[ds] = max(ws.level[ds], ws.level[s] + 1); // ds > s なので s の段数は確定している
+        ws.upStart[ds + 1]++;
+    }
+    for (size_t s = 0; s < n; ++s) ws.upStart[s + 1] += ws.upStart[s];
+    ws.upList.resize(ws.upStart[n]);
+    vector<uint32_t> fill(ws.upStart.begin(), ws.upStart.end() - 1);
+    for (size_t s = 0; s < n; ++s) {
+        if (ws.downstream[s] != FLOW_NONE) ws.upList[fill[ws.downstream[s]]++] = (uint32_t)s;
+    }
+
+    return ws;
+}
+
+// 上流の小流域が全部終わったものから順にスレッドで実行する
+void forEachSubBasin(const Watershed& ws, const function<void(uint32_t)>& fn) {
+    const size_t n = ws.count();
+    vector<uint32_t> waiting(n); // 終わっていない上流の数
+    vector<uint32_t> ready;      // 実行できる小流域
+    ready.reserve(n);
+    for (size_t s = 0; s < n; ++s) {
+        waiting[s] = ws.upStart[s + 1] - ws.upStart[s];
+        if (waiting[s] == 0) ready.push_back((uint32_t)s);
+    }
+    size_t head = 0;
+    size_t done = 0;
+
+#pragma omp parallel
+    {
+        for (;;) {
+            uint32_t s = FLOW_NONE;
+            bool finished = false;
+#pragma omp critical(subbasin_queue)
+            {
+                if (head < ready.size()) s = ready[head++];
+                else if (done == n) finished = true;
+            }
+            if (finished) break;
+            if (s == FLOW_NONE) {
+                this_thread::yield(); // 上流の計算を待つ
+                continue;
+            }
+
+            fn(s);
+
+#pragma omp critical(subbasin_queue)
+            {
+                ++done;
+                uint32_t ds = ws.downstream[s];
+                if (ds != FLOW_NONE && --waiting[ds] == 0) ready.push_back(ds);
+            }
+        }
+    }
+}
+
+// 小流域ごとの上流の全セル数
+// 自分のセル数に上流の小流域の値を足すので、上流が全部終わってから実行する必要がある
+size_t accumulateSubBasins(Watershed& ws, const FlowAccumulation& acc) {
+    const size_t n = ws.count();
+    ws.upCells.assign(n, 0);
+    forEachSubBasin(ws, [&](uint32_t s) {
+        uint32_t total = ws.cells[s];
+        for (uint32_t k = ws.upStart[s]; k < ws.upStart[s + 1]; ++k) total += ws.upCells[ws.upList[k]];
+        ws.upCells[s] = total;
+    });
+
+    size_t mismatch = 0;
+    for (size_t s = 0; s < n; ++s) {
+        if (ws.upCells[s] != acc.count[ws.outlet[s]]) ++mismatch;
+    }
+    return mismatch;
+}
+
+// 小流域の画像（番号ごとに色分け）
+void saveWatershedImage(const Watershed& ws, const char* filename) {
+    const size_t cells = ws.label.size();
+    vector<unsigned char> image(cells * 3, 0);
+    for (size_t i = 0; i < cells; ++i) {
+        uint32_t s = ws.label[i];
+        if (s == FLOW_NONE) continue;
+        uint32_t hsh = s * 2654435761u; // 隣の番号が似た色にならないように混ぜる
+        image[i * 3 + 0] = (unsigned char)(64 + (hsh >> 24) % 192);
+        image[i * 3 + 1] = (unsigned char)(64 + (hsh >> 16) % 192);
+        image[i * 3 + 2] = (unsigned char)(64 + (hsh >> 8) % 192);
+    }
+
+    if (stbi_write_png(filename, ws.width, ws.height, 3, image.data(), ws.width * 3)) {
+        cout << "小流域画像保存成功: " << filename << "\n";
+    }
+    else {
+        cerr << "小流域画像保存失敗: " << filename << "\n";
+    }
+}
+
+// 小流域の一覧
+bool saveWatershedCsv(const Watershed& ws, const string& filename) {
+    ofstream file(filename);
+    if (!file) {
+        cerr << "ファイルを開けません: " << filename << "\n";
+        return false;
+    }
+    file << "id,outlet_y,outlet_x,downstream,cells,level,upstream_cells\n";
+    for (size_t s = 0; s < ws.count(); ++s) {
+        file << s << "," << ws.outlet[s] / ws.width << "," << ws.outlet[s] % ws.width << ",";
+        if (ws.downstream[s] == FLOW_NONE) file << -1;
+        else file << ws.downstream[s];
+        file << "," << ws.cells[s] << "," << ws.level[s] << ",";
+        if (s < ws.upCells.size()) file << ws.upCells[s];
+        file << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+﻿#ifndef WATERSHED_H
+#define WATERSHED_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include "flowacc.h"
+
+using namespace std;
+
+// 小流域への分割
+// 小流域の番号は上流から順に付くので、流れ込む先の番号は必ず自分より大きい
+struct Watershed {
+    int width = 0;
+    int height = 0;
+    vector<uint32_t> label;      // セルごとの小流域番号
+
+    // 小流域ごと
+    vector<uint32_t> outlet;     // 出口のセル
+    vector<uint32_t> downstream; // 流れ込む先の小流域（なし = FLOW_NONE）
+    vector<uint32_t> cells;      // セル数
+    vector<uint32_t> level;      // 最上流からの段数（0 = 上流に小流域がない）
+    vector<uint32_t> upStart;    // 上流の小流域（upList[upStart[s]] 〜 upList[upStart[s+1]-1]）
+    vector<uint32_t> upList;
+    vector<uint32_t> upCells;    // 出口より上流の全セル数（accumulateSubBasins で求める）
+
+    size_t count() const { return outlet.size(); }
+};
+
+// 流向から小流域に分ける
+// 上流から順にセル数をためていき、targetCells 以上になったセルと領域の出口で区切る
+Watershed delineateWatersheds(const FlowAccumulation& acc, uint32_t targetCells);
+
+// 上流の小流域が全部終わったものから順にスレッドで実行する
+// 独立した小流域どうしは合流するまで同期しない
+void forEachSubBasin(const Watershed& ws, const function<void(uint32_t)>& fn);
+
+// 小流域ごとの上流の全セル数を forEachSubBasin で求めて upCells に入れる
+// 出口の流量累積と一致しない小流域の数を返す（0 なら依存関係と実行順が正しい）
+size_t accumulateSubBasins(Watershed& ws, const FlowAccumulation& acc);
+
+// 小流域の画像（番号ごとに色分け）
+void saveWatershedImage(const Watershed& ws, const char* filename);
+
+// 小流域の一覧（番号,出口のy,x,流れ込む先,セル数,段数,上流の全セル数）
+bool saveWatershedCsv(const Watershed& ws, const string& filename);
+
+#endif // WATERSHED_H